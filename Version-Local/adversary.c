@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "adversary.h"
+#include "reading.h"
+#include "pool.h"
+#include "util.h"
+
+/* The lookahead adversary. Instead of always keeping the biggest family,
+   it searches a few guesses ahead: the adversary picks the family with
+   the best value, assuming the player then picks the letter that is
+   worst for the adversary, and so on (minimax), until depth guesses have
+   been looked at. A state is then valued by leaf_value.
+
+   To stay interactive the search is pruned three ways: only the biggest
+   families (and the "no letter" family) and the most promising letters
+   are expanded, alpha-beta bounds cut off branches that cannot change the
+   result, and the last level is valued straight from generate_histograms
+   without partitioning. The families at the root are searched in
+   parallel on a pool of threads, one depth at a time (iterative
+   deepening), and when the time budget runs out the result of the last
+   depth that was searched completely is used.
+
+   The threads and the deadline of a search belong to a search_context,
+   so rounds played at the same time each search with their own.
+*/
+
+/* Value of a state the adversary has won; its negation is a state the
+   player has won. */
+#define WIN_VALUE 1000.0
+
+/* How many doublings of the words left one wrong guess is worth. */
+#define MISS_WEIGHT 3.0
+
+/* Most families of the guessed letter searched at the root. */
+#define ROOT_WIDTH 16
+
+/* Most families, and most letters, searched below the root. */
+#define ADVERSARY_WIDTH 6
+#define PLAYER_WIDTH 6
+
+/* Number of guesses looked ahead; 1 means the greedy biggest family. */
+static int search_depth = DEFAULT_DEPTH;
+
+/* Time allowed for one choose_family, in nanoseconds. */
+static long budget_ns;
+
+/* Where one round's adversary searches. */
+struct search_context {
+    struct pool *workers; /* Search the root families and partition big lists */
+    long deadline_ns; /* When the search in progress must end */
+    int timed_out; /* Set by the first thread that finds it has */
+};
+
+/* The root of a search: the families choose_family picks from and the
+   value each of them got at the depth being searched. */
+struct root_search {
+    struct search_context *search;
+    Family *families[ROOT_WIDTH + 1];
+    double values[ROOT_WIDTH + 1];
+    int num_families;
+    uint32_t guessed;
+    int guesses_left;
+    int depth;
+};
+
+
+/* Set up the adversary to look depth guesses ahead, searching for at
+   most budget_ms milliseconds per choice.
+   This function should be called once, on startup.
+*/
+void init_adversary(int depth, int budget_ms) {
+    search_depth = depth;
+    budget_ns = budget_ms * 1000000L;
+}
+
+
+/* Return the number of guesses the adversary looks ahead. */
+int get_adversary_depth(void) {
+    return search_depth;
+}
+
+
+/* Return a new search context, whose searches and large partitions
+   run on num_threads threads, counting the one calling choose_family.
+   Every thread that plays rounds needs one of its own. Call
+   init_adversary first.
+*/
+struct search_context *create_search_context(int num_threads) {
+    struct search_context *search = malloc(sizeof(struct search_context));
+    if (search == NULL) {
+        perror("malloc error in create_search_context");
+        exit(1);
+    }
+    search->workers = create_pool(num_threads);
+    search->deadline_ns = 0;
+    search->timed_out = 0;
+    return search;
+}
+
+
+/* Return the threads of search. They are free for other work, such as
+   partition_rows_parallel, whenever no choose_family is running.
+*/
+struct pool *get_search_pool(struct search_context *search) {
+    return search->workers;
+}
+
+
+/* Return the value, for the adversary, of num_words words being left
+   with guesses_left guesses: one guess fewer counts as much as
+   MISS_WEIGHT doublings of the words left.
+*/
+static double leaf_value(int num_words, int guesses_left) {
+    if (guesses_left <= 0) {
+        return WIN_VALUE;
+    }
+    return log2(num_words) - MISS_WEIGHT * guesses_left;
+}
+
+
+/* Return the value for the adversary of the best family in hist, with
+   guesses_left guesses before the guess of hist's letter.
+*/
+static double histogram_value(Histogram *hist, int guesses_left) {
+    double best = -INFINITY;
+    for (int fam = 0; fam < hist->num_families; fam++) {
+        int left = guesses_left - (hist->masks[fam] == 0);
+        double value = leaf_value(hist->counts[fam], left);
+        if (value > best) {
+            best = value;
+        }
+    }
+    return best;
+}
+
+
+/* Fill picked with the width biggest families of fam_list, biggest first,
+   followed by its "no letter" family if that is not among them already.
+   Return the number of families picked.
+*/
+static int pick_families(Family *fam_list, Family **picked, int width) {
+    int num_picked = 0;
+    Family *miss = NULL;
+    for (Family *fam = fam_list; fam != NULL; fam = fam->next) {
+        if (fam->mask == 0) {
+            miss = fam;
+        }
+        int i = num_picked < width ? num_picked++ : width;
+        while (i > 0 && picked[i - 1]->num_words < fam->num_words) {
+            if (i < width) {
+                picked[i] = picked[i - 1];
+            }
+            i--;
+        }
+        if (i < width) {
+            picked[i] = fam;
+        }
+    }
+    for (int i = 0; i < num_picked && miss != NULL; i++) {
+        if (picked[i] == miss) {
+            miss = NULL;
+        }
+    }
+    if (miss != NULL) {
+        picked[num_picked++] = miss;
+    }
+    return num_picked;
+}
+
+
+/* A letter the player could guess next, and its value one guess ahead. */
+struct letter_choice {
+    double value;
+    int bit; /* The letter is 'a' + bit */
+};
+
+/* Order letter choices by increasing value, the player's best first. */
+static int compare_letters(const void *a, const void *b) {
+    double x = ((const struct letter_choice *) a)->value;
+    double y = ((const struct letter_choice *) b)->value;
+    return (x > y) - (x < y);
+}
+
+
+static double adversary_value(struct search_context *search, Family *fam_list,
+                              uint32_t guessed, int guesses_left, int depth,
+                              double alpha, double beta);
+
+
+/* Return the value for the adversary when the num_words words are left,
+   the letters in guessed have been guessed, and the player, with
+   guesses_left guesses, picks the next letter. Look depth guesses ahead.
+   Values outside (alpha, beta) need not be exact.
+*/
+static double player_value(struct search_context *search, char **words, int num_words,
+                           uint32_t guessed, int guesses_left, int depth,
+                           double alpha, double beta) {
+    if (guesses_left <= 0) {
+        return WIN_VALUE;
+    }
+    if ((word_letters(words[0]) & ~guessed) == 0) {
+        return -WIN_VALUE; /* Every word left is the same, fully shown word */
+    }
+    if (depth == 0) {
+        return leaf_value(num_words, guesses_left);
+    }
+    if (now_ns() > search->deadline_ns) {
+        __atomic_store_n(&search->timed_out, 1, __ATOMIC_RELAXED);
+        return leaf_value(num_words, guesses_left);
+    }
+
+    /* Value every letter one guess ahead, all from one pass. */
+    struct letter_choice letters[26];
+    int num_letters = 0;
+    Histogram *hists = generate_histograms(words, num_words, guessed);
+    for (int bit = 0; bit < 26; bit++) {
+        if (!(guessed & (1u << bit))) {
+            letters[num_letters].value = histogram_value(&hists[bit], guesses_left);
+            letters[num_letters].bit = bit;
+            num_letters++;
+        }
+    }
+    deallocate_histograms(hists);
+    qsort(letters, num_letters, sizeof(struct letter_choice), compare_letters);
+    if (depth == 1) {
+        return letters[0].value;
+    }
+
+    /* Look deeper at the letters that look best for the player. The
+       words are partitioned from a copy, since they are a range of the
+       families being searched above, or of the round's candidates. */
+    double best = INFINITY;
+    for (int i = 0; i < num_letters && i < PLAYER_WIDTH; i++) {
+        int bit = letters[i].bit;
+        Family *fam_list = partition_copy(words, num_words, 'a' + bit);
+        double value = adversary_value(search, fam_list, guessed | (1u << bit),
+                                       guesses_left, depth - 1, alpha,
+                                       best < beta ? best : beta);
+        deallocate_families(fam_list);
+        if (value < best) {
+            best = value;
+        }
+        if (best <= alpha) {
+            break;
+        }
+    }
+    return best;
+}
+
+
+/* Return the value for the adversary of picking the best family of
+   fam_list, which the letters in guessed have just been split into,
+   with guesses_left guesses before the last one. Look depth guesses ahead.
+*/
+static double adversary_value(struct search_context *search, Family *fam_list,
+                              uint32_t guessed, int guesses_left, int depth,
+                              double alpha, double beta) {
+    Family *picked[ADVERSARY_WIDTH + 1];
+    int num_picked = pick_families(fam_list, picked, ADVERSARY_WIDTH);
+    double best = -INFINITY;
+    for (int i = 0; i < num_picked; i++) {
+        Family *fam = picked[i];
+        double value = player_value(search, fam->word_ptrs, fam->num_words, guessed,
+                                    guesses_left - (fam->mask == 0), depth,
+                                    best > alpha ? best : alpha, beta);
+        if (value > best) {
+            best = value;
+        }
+        if (best >= beta) {
+            break;
+        }
+    }
+    return best;
+}
+
+
+/* Search the root family number task of the root_search context. */
+static void search_root_family(void *context, int task) {
+    struct root_search *root = context;
+    Family *fam = root->families[task];
+    root->values[task] = player_value(root->search, fam->word_ptrs, fam->num_words,
+                                      root->guessed, root->guesses_left - (fam->mask == 0),
+                                      root->depth, -INFINITY, INFINITY);
+}
+
+
+/* Return the family of fam_list the adversary keeps, where fam_list is
+   the partition of the words by the latest guess, guessed holds the
+   letters guessed so far including that one (bit i for 'a' + i), and
+   guesses_left is the number of guesses the player had before it.
+   The search runs in search. With a depth of 1 this is the biggest family.
+*/
+Family *choose_family(struct search_context *search, Family *fam_list, uint32_t guessed,
+                      int guesses_left) {
+    Family *choice = find_biggest_family(fam_list);
+    if (search_depth <= 1 || fam_list == NULL) {
+        return choice;
+    }
+    struct root_search root;
+    root.num_families = pick_families(fam_list, root.families, ROOT_WIDTH);
+    if (root.num_families == 1) {
+        return choice;
+    }
+    root.search = search;
+    root.guessed = guessed;
+    root.guesses_left = guesses_left;
+    search->deadline_ns = now_ns() + budget_ns;
+    search->timed_out = 0;
+
+    /* Iterative deepening: only a depth searched in full is trusted. */
+    for (root.depth = 1; root.depth < search_depth; root.depth++) {
+        pool_run(search->workers, search_root_family, &root, root.num_families);
+        if (__atomic_load_n(&search->timed_out, __ATOMIC_RELAXED)) {
+            break;
+        }
+        int best = 0;
+        for (int i = 1; i < root.num_families; i++) {
+            if (root.values[i] > root.values[best]) {
+                best = i;
+            }
+        }
+        choice = root.families[best];
+    }
+    return choice;
+}
+
+
+/* Stop the threads of search and deallocate it. */
+void destroy_search_context(struct search_context *search) {
+    destroy_pool(search->workers);
+    free(search);
+}
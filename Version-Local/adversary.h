@@ -0,0 +1,23 @@
+#ifndef ADVERSARY_H
+#define ADVERSARY_H
+
+#include <stdint.h>
+#include "family.h"
+
+/* Lookahead depth of the adversary; 1 is the greedy biggest family. */
+#define DEFAULT_DEPTH 1
+
+/* Time budget in milliseconds for choosing a family. */
+#define DEFAULT_BUDGET_MS 50
+
+struct search_context;
+
+void init_adversary(int depth, int budget_ms);
+int get_adversary_depth(void);
+struct search_context *create_search_context(int num_threads);
+struct pool *get_search_pool(struct search_context *search);
+Family *choose_family(struct search_context *search, Family *fam_list, uint32_t guessed,
+                      int guesses_left);
+void destroy_search_context(struct search_context *search);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "family.h"
+#include "reading.h"
+#include "rows.h"
+#include "pool.h"
+#include "util.h"
+
+/* Microbenchmarks of the family engine over a real dictionary:
+       benchmark <dictionary>
+   Every benchmark runs over every word length, with all 26 letters where
+   it takes one, and prints one line of key=value pairs per length, so
+   runs of different engine versions can be compared line by line.
+   generate_families, serial and parallel, also runs over the whole
+   dictionary at once, reported as length 0.
+   Every row kernel is checked against the letter index before it is
+   timed, and the parallel partitions against the serial ones on
+   CHECK_THREADS threads, so that they do take the parallel path; a
+   wrong result stops the run with an error.
+   Linked with --wrap=malloc (and calloc, realloc and posix_memalign),
+   so the allocations the engine makes are counted.
+*/
+
+/* Words (or families) each timed trial processes at least, and trials
+   per benchmark; the fastest trial is reported.
+*/
+#define BENCH_WORDS (1 << 20)
+#define BENCH_TRIALS 3
+
+/* Threads the parallel partitions are checked on, whatever the number
+   of processors. */
+#define CHECK_THREADS 4
+
+/* Times the engine has called malloc, calloc, realloc or posix_memalign. */
+static long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+
+/* The words of one length and what a benchmark needs of them. */
+struct bench_input {
+    struct pool *pool; /* One thread per processor */
+    int length;
+    char **words; /* NULL-terminated, as in the dictionary */
+    char **scratch; /* A copy of words to reorder */
+    Rows rows; /* The words of scratch packed by new_rows, in the same order */
+    uint64_t *masks; /* Output of row_masks */
+    int num_words;
+    Family *partitions[26]; /* The partition of words by each letter; only
+                               the family sizes stay valid, since the later
+                               partitions reorder scratch */
+    long num_families; /* Number of families in partitions */
+};
+
+/* A benchmark: run one operation over input, for every letter if it
+   takes one, and return the number of words it processed, or of
+   families for a benchmark that never looks at a word.
+*/
+typedef long (*bench_fn)(struct bench_input *input);
+
+
+static long bench_generate_families(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        deallocate_families(generate_families(input->words, letter));
+    }
+    return 26L * input->num_words;
+}
+
+
+static long bench_generate_families_parallel(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        deallocate_families(generate_families_parallel(input->words, letter, input->pool));
+    }
+    return 26L * input->num_words;
+}
+
+
+static long bench_partition_families(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        deallocate_families(partition_families(input->scratch, input->num_words, letter));
+    }
+    return 26L * input->num_words;
+}
+
+
+static long bench_partition_rows(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        deallocate_families(partition_rows(input->scratch, &input->rows, input->num_words,
+                                           letter));
+    }
+    return 26L * input->num_words;
+}
+
+
+/* Finding every word's signature mask, from the letter index and from
+   each row kernel.
+*/
+static long bench_letter_index(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        for (int i = 0; i < input->num_words; i++) {
+            input->masks[i] = word_letter_positions(input->scratch[i], letter);
+        }
+    }
+    return 26L * input->num_words;
+}
+
+
+static long bench_row_masks(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        row_masks(input->rows.data, input->num_words, input->length, letter, input->masks);
+    }
+    return 26L * input->num_words;
+}
+
+
+static long bench_find_biggest_family(struct bench_input *input) {
+    for (int letter = 0; letter < 26; letter++) {
+        find_biggest_family(input->partitions[letter]);
+    }
+    return input->num_families;
+}
+
+
+static long bench_generate_histograms(struct bench_input *input) {
+    deallocate_histograms(generate_histograms(input->scratch, input->num_words, 0));
+    return input->num_words;
+}
+
+
+/* The benchmarks, by the name of the function they measure, and what
+   they count as processed. */
+static const struct {
+    char *name;
+    bench_fn run;
+    char *unit;
+} benchmarks[] = {
+    {"generate_families", bench_generate_families, "words"},
+    {"generate_families_parallel", bench_generate_families_parallel, "words"},
+    {"partition_families", bench_partition_families, "words"},
+    {"partition_rows", bench_partition_rows, "words"},
+    {"letter_index", bench_letter_index, "words"},
+    {"row_masks", bench_row_masks, "words"},
+    {"find_biggest_family", bench_find_biggest_family, "families"},
+    {"generate_histograms", bench_generate_histograms, "words"},
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+
+/* Print one result line: ops runs of benchmark name over length-length
+   words, which processed count of unit (words or families) in ns
+   nanoseconds and made allocs allocations. A length of 0 stands for the
+   whole dictionary.
+*/
+static void report(char *name, int length, long ops, char *unit, long count, long ns,
+                   long allocs) {
+    printf("benchmark=%s length=%d ops=%ld %s=%ld ns_per_op=%.1f "
+           "%s_per_sec=%.0f allocs_per_op=%.2f\n",
+           name, length, ops, unit, count, (double) ns / ops,
+           unit, ns > 0 ? count * 1e9 / ns : 0.0, (double) allocs / ops);
+}
+
+
+/* Check that the current row kernel finds the same masks for every
+   letter as the letter index does, and terminate if it does not.
+*/
+static void check_row_kernel(struct bench_input *input) {
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        row_masks(input->rows.data, input->num_words, input->length, letter, input->masks);
+        for (int i = 0; i < input->num_words; i++) {
+            if (input->masks[i] != word_letter_positions(input->scratch[i], letter)) {
+                fprintf(stderr, "row kernel %s is wrong for %s, letter %c\n",
+                        get_row_kernel(), input->scratch[i], letter);
+                exit(1);
+            }
+        }
+    }
+}
+
+
+/* Check that the families of parallel are those of serial, in the same
+   order and with the same words in the same order, and terminate with
+   an error naming name if they are not.
+*/
+static void check_same_families(const char *name, Family *parallel, Family *serial) {
+    while (parallel != NULL && serial != NULL) {
+        if (parallel->mask != serial->mask || parallel->length != serial->length ||
+            parallel->num_words != serial->num_words ||
+            memcmp(parallel->word_ptrs, serial->word_ptrs,
+                   sizeof(char *) * serial->num_words) != 0) {
+            break;
+        }
+        parallel = parallel->next;
+        serial = serial->next;
+    }
+    if (parallel != NULL || serial != NULL) {
+        fprintf(stderr, "%s differs from its serial version\n", name);
+        exit(1);
+    }
+}
+
+
+/* Check generate_families_parallel against generate_families over the
+   num_words words of words, and partition_rows_parallel against
+   partition_rows over the words of the most common length, repeated to
+   PARALLEL_MIN_WORDS at least, for every letter. Terminate if either
+   differs.
+*/
+static void check_parallel(Dictionary *dict, char **words, int num_words) {
+    struct pool *pool = create_pool(CHECK_THREADS);
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        Family *parallel = generate_families_parallel(words, letter, pool);
+        Family *serial = generate_families(words, letter);
+        check_same_families("generate_families_parallel", parallel, serial);
+        deallocate_families(parallel);
+        deallocate_families(serial);
+    }
+
+    int length = 1, count = 0;
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        int num;
+        get_words_of_length(dict, len, &num);
+        if (num > count) {
+            length = len;
+            count = num;
+        }
+    }
+    char **source = get_words_of_length(dict, length, &count);
+    int total = (PARALLEL_MIN_WORDS + count - 1) / count * count;
+    char **parallel_words = malloc(sizeof(char *) * total);
+    char **serial_words = malloc(sizeof(char *) * total);
+    if (parallel_words == NULL || serial_words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < total; i++) {
+        parallel_words[i] = serial_words[i] = source[i % count];
+    }
+    Rows parallel_rows = {new_rows(parallel_words, total, length), row_stride(length),
+                          get_length_kernel(length)};
+    Rows serial_rows = {new_rows(serial_words, total, length), row_stride(length),
+                        get_length_kernel(length)};
+    for (char letter = 'a'; letter <= 'z'; letter++) {
+        Family *parallel = partition_rows_parallel(parallel_words, &parallel_rows, total,
+                                                   letter, pool);
+        Family *serial = partition_rows(serial_words, &serial_rows, total, letter);
+        check_same_families("partition_rows_parallel", parallel, serial);
+        if (memcmp(parallel_rows.data, serial_rows.data,
+                   (size_t) total * serial_rows.stride) != 0) {
+            fprintf(stderr, "partition_rows_parallel moves the rows differently\n");
+            exit(1);
+        }
+        deallocate_families(parallel);
+        deallocate_families(serial);
+    }
+    free(parallel_rows.data);
+    free(serial_rows.data);
+    free(parallel_words);
+    free(serial_words);
+    destroy_pool(pool);
+}
+
+
+/* Put scratch back in the order of words, and pack rows from it again.
+   partition_families reorders scratch alone, so without this the row
+   benchmarks after it would pair each word with another word's row.
+*/
+static void reset_scratch(struct bench_input *input) {
+    if (input->scratch == NULL) { /* The whole dictionary has no rows */
+        return;
+    }
+    memcpy(input->scratch, input->words, sizeof(char *) * input->num_words);
+    free(input->rows.data);
+    input->rows.data = new_rows(input->scratch, input->num_words, input->length);
+}
+
+
+/* Run benchmark number bench over input and report the fastest trial,
+   as name. Every benchmark starts from scratch in the order of words.
+*/
+static void run_benchmark(int bench, const char *name, struct bench_input *input) {
+    reset_scratch(input);
+    long best_ns = -1, best_allocs = 0, ops = 0, words = 0;
+    for (int trial = 0; trial < BENCH_TRIALS; trial++) {
+        long trial_words = 0, trial_ops = 0;
+        long allocs = allocations;
+        long start = now_ns();
+        do {
+            trial_words += benchmarks[bench].run(input);
+            trial_ops++;
+        } while (trial_words < BENCH_WORDS);
+        long ns = now_ns() - start;
+        if (best_ns < 0 || ns < best_ns) {
+            best_ns = ns;
+            best_allocs = allocations - allocs;
+            ops = trial_ops;
+            words = trial_words;
+        }
+    }
+    report((char *) name, input->length, ops, benchmarks[bench].unit, words, best_ns,
+           best_allocs);
+}
+
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <dictionary>\n", argv[0]);
+        exit(1);
+    }
+    init_family(1024);
+
+    /* Loading the dictionary, which read_words used to do. */
+    Dictionary *dict = NULL;
+    long best_ns = -1, best_allocs = 0;
+    for (int trial = 0; trial < BENCH_TRIALS; trial++) {
+        if (dict != NULL) {
+            deallocate_dictionary(dict);
+        }
+        long allocs = allocations;
+        long start = now_ns();
+        dict = read_dictionary(argv[1]);
+        long ns = now_ns() - start;
+        if (best_ns < 0 || ns < best_ns) {
+            best_ns = ns;
+            best_allocs = allocations - allocs;
+        }
+    }
+    report("read_dictionary", 0, 1, "words", dict->num_words, best_ns, best_allocs);
+
+    struct bench_input input;
+    input.pool = create_pool(sysconf(_SC_NPROCESSORS_ONLN));
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        input.words = get_words_of_length(dict, len, &input.num_words);
+        if (input.num_words == 0) {
+            continue;
+        }
+        input.length = len;
+        input.scratch = malloc(sizeof(char *) * input.num_words);
+        if (input.scratch == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        input.rows.data = NULL;
+        input.rows.stride = row_stride(len);
+        input.rows.kernel = get_length_kernel(len);
+        input.masks = malloc(sizeof(uint64_t) * input.num_words);
+        if (input.masks == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        reset_scratch(&input);
+        input.num_families = 0;
+        for (int letter = 0; letter < 26; letter++) {
+            input.partitions[letter] = partition_families(input.scratch, input.num_words,
+                                                          'a' + letter);
+            for (Family *fam = input.partitions[letter]; fam != NULL; fam = fam->next) {
+                input.num_families++;
+            }
+        }
+        for (size_t bench = 0; bench < NUM_BENCHMARKS; bench++) {
+            if (benchmarks[bench].run != bench_row_masks) {
+                run_benchmark(bench, benchmarks[bench].name, &input);
+                continue;
+            }
+            /* Every kernel this processor runs, checked and then timed,
+               then back to the default. */
+            const char *chosen = get_row_kernel();
+            for (int i = 0; i < NUM_ROW_KERNELS; i++) {
+                char name[64];
+                if (set_row_kernel(row_kernel_names[i]) == 0) {
+                    reset_scratch(&input);
+                    check_row_kernel(&input);
+                    snprintf(name, sizeof(name), "row_masks_%s", row_kernel_names[i]);
+                    run_benchmark(bench, name, &input);
+                }
+            }
+            set_row_kernel(chosen);
+        }
+        for (int letter = 0; letter < 26; letter++) {
+            deallocate_families(input.partitions[letter]);
+        }
+        free(input.scratch);
+        free(input.rows.data);
+        free(input.masks);
+    }
+
+    /* The whole dictionary, which is where the parallel path pays off. */
+    input.length = 0;
+    input.num_words = 0;
+    input.scratch = NULL;
+    input.words = malloc(sizeof(char *) * (dict->num_words + 1));
+    if (input.words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        int count;
+        char **words = get_words_of_length(dict, len, &count);
+        for (int i = 0; i < count; i++) {
+            input.words[input.num_words++] = words[i];
+        }
+    }
+    input.words[input.num_words] = NULL;
+    check_parallel(dict, input.words, input.num_words);
+    for (size_t bench = 0; bench < NUM_BENCHMARKS; bench++) {
+        if (benchmarks[bench].run == bench_generate_families ||
+            benchmarks[bench].run == bench_generate_families_parallel) {
+            run_benchmark(bench, benchmarks[bench].name, &input);
+        }
+    }
+    free(input.words);
+    destroy_pool(input.pool);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) {
+        perror("getrusage");
+        exit(1);
+    }
+    printf("benchmark=peak_rss length=0 kb=%ld\n", usage.ru_maxrss);
+    deallocate_dictionary(dict);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "book.h"
+
+/* Map the opening book filename into memory and return it. Return NULL
+   if filename cannot be opened, or if it is not an opening book for the
+   words with checksum dictionary, so the game plays without one.
+   A book that has the magic but is truncated or of another version is
+   reported and terminates the program.
+*/
+Book *open_book(char *filename, uint64_t dictionary) {
+    struct book_header header;
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, BOOK_MAGIC, sizeof(header.magic)) != 0
+        || header.dictionary != dictionary) {
+        close(fd);
+        return NULL;
+    }
+    if (header.version != BOOK_VERSION) {
+        fprintf(stderr, "%s: opening book version %u, expected %u\n",
+                filename, header.version, BOOK_VERSION);
+        exit(1);
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(1);
+    }
+    size_t expected = sizeof(header)
+                      + (size_t) header.num_blocks * BOOK_BLOCK * sizeof(struct book_entry);
+    if ((size_t) st.st_size != expected) {
+        fprintf(stderr, "%s: opening book is %ld bytes, expected %lu\n",
+                filename, (long) st.st_size, (unsigned long) expected);
+        exit(1);
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    close(fd);
+
+    Book *book = malloc(sizeof(Book));
+    if (book == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    book->header = (const struct book_header *) map;
+    book->entries = (const struct book_entry *) (map + sizeof(header));
+    book->map_size = st.st_size;
+    return book;
+}
+
+
+/* Look up the family the greedy adversary keeps when letter is guessed
+   from pos. Only the first two guesses of a game are in book, and the
+   second only if the first revealed what the book says it does. If it
+   is there, store its signature mask in mask and its size in num_words,
+   and return 1; otherwise return 0.
+*/
+int lookup_book(Book *book, Position *pos, char letter, uint64_t *mask, int *num_words) {
+    if (book == NULL || pos->length < 0 || pos->length > MAX_WORD_LENGTH
+        || book->header->block[pos->length] == BOOK_NONE) {
+        return 0;
+    }
+    const struct book_entry *block = book->entries
+                                     + (size_t) book->header->block[pos->length] * BOOK_BLOCK;
+    const struct book_entry *entry;
+    if (pos->guessed == 0) {
+        entry = &block[(letter - 'a') * 27];
+    } else if ((pos->guessed & (pos->guessed - 1)) == 0) {
+        int first = __builtin_ctz(pos->guessed);
+        uint64_t revealed = 0;
+        for (int i = 0; i < pos->length; i++) {
+            if (pos->pattern[i] == 'a' + first) {
+                revealed |= (uint64_t) 1 << i;
+            }
+        }
+        if (revealed != block[first * 27].mask) {
+            return 0;
+        }
+        entry = &block[first * 27 + 1 + (letter - 'a')];
+    } else {
+        return 0;
+    }
+    if (entry->num_words == 0) {
+        return 0;
+    }
+    *mask = entry->mask;
+    *num_words = entry->num_words;
+    return 1;
+}
+
+
+/* Unmap the opening book mapped by open_book. */
+void close_book(Book *book) {
+    if (book != NULL) {
+        munmap((void *) book->header, book->map_size);
+        free(book);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "family.h"
+
+/* Opening book, built by mkbook and mapped by wheel at startup: for every
+   word length, the family the greedy adversary keeps for every first
+   guess, and for every second guess after it. These are the moves that
+   split a whole length bucket, so they are the most expensive ones, and
+   they come out the same in every game.
+
+   The file is laid out as:
+     - struct book_header
+     - one block of BOOK_BLOCK struct book_entry per word length that has
+       words. Entry first * 27 is the first guess 'a' + first, and entry
+       first * 27 + 1 + second is the guess 'a' + second after it.
+   All fields are in the byte order of the machine that built the file.
+*/
+
+/* First bytes of every opening book. */
+#define BOOK_MAGIC "HANGBOOK"
+
+/* Bumped whenever the layout of the file changes. */
+#define BOOK_VERSION 1
+
+/* The opening book wheel looks for. */
+#define OPENING_BOOK "opening.book"
+
+/* Entries per word length; block[len] is BOOK_NONE for lengths without words. */
+#define BOOK_BLOCK (26 * 27)
+#define BOOK_NONE UINT32_MAX
+
+struct book_header {
+    char magic[8]; /* BOOK_MAGIC, without the terminating '\0' */
+    uint32_t version; /* BOOK_VERSION */
+    uint32_t num_blocks; /* Number of blocks of entries */
+    uint64_t dictionary; /* get_dictionary_checksum of the words */
+    uint32_t block[MAX_WORD_LENGTH + 1]; /* Block of each length, or BOOK_NONE */
+};
+
+/* The family kept for one guess. num_words is 0 if the guess repeats
+   the first one.
+*/
+struct book_entry {
+    uint64_t mask; /* Signature mask of the family */
+    uint32_t num_words; /* Number of words in the family */
+    uint32_t num_families; /* Number of families the guess made */
+};
+
+/* An opening book mapped into memory by open_book. */
+typedef struct book {
+    const struct book_header *header;
+    const struct book_entry *entries;
+    size_t map_size;
+} Book;
+
+Book *open_book(char *filename, uint64_t dictionary);
+int lookup_book(Book *book, Position *pos, char letter, uint64_t *mask, int *num_words);
+void close_book(Book *book);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dictfile.h"
+#include "reading.h"
+
+/* Return a checksum of the size bytes at data (64-bit FNV-1a over
+   8-byte words). size must be a multiple of 8 and data 8-byte aligned,
+   which holds for everything after the header of a compiled dictionary.
+*/
+uint64_t dict_checksum(const void *data, size_t size) {
+    const uint64_t *word = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+        hash ^= word[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+/* Return the index of the first word of the compiled dictionary df that
+   does not lie in its blob, or -1 if all of them do. A word lies in the
+   blob if it is 8-byte aligned, its letter index and masks fit in front
+   of it, the index gives the length of its bucket, and its '\0' is in
+   the blob too. This reads every word's index, but not the checksums.
+*/
+static int check_dict_words(struct dict_file *df) {
+    const struct dict_header *header = df->header;
+    uint32_t i = 0;
+    for (int len = 0; len <= DICT_MAX_LENGTH; len++) {
+        for (uint32_t end = i + header->bucket_size[len]; i < end; i++) {
+            uint64_t offset = df->offsets[i];
+            if (offset % 8 != 0 || offset < sizeof(struct word_index)
+                || offset + len + 1 > header->blob_size) {
+                return i;
+            }
+            const struct word_index *index = get_word_index(dict_file_word(df, i));
+            uint64_t prefix = sizeof(struct word_index)
+                              + sizeof(uint64_t) * __builtin_popcount(index->present);
+            if (index->present >> 26 != 0 || index->length != (uint32_t) len
+                || offset < prefix || df->blob[offset + len] != '\0') {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+
+/* Map the compiled dictionary filename into memory and fill in df.
+   Return 0 on success, or -1 if filename cannot be opened or is not a
+   compiled dictionary, so the caller can fall back to reading it as text.
+   A file that has the magic but is of another version, whose sections
+   do not add up to its size, or whose buckets or words do not lie where
+   they should, is reported and terminates the program. The checksums
+   are not checked here; see verify_dict_file.
+*/
+int open_dict_file(char *filename, struct dict_file *df) {
+    struct dict_header header;
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    /* Only a regular file can be mapped; reading the header of anything
+       else would also take those bytes from the text reader. */
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, DICT_MAGIC, sizeof(header.magic)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (header.version != DICT_VERSION) {
+        fprintf(stderr, "%s: compiled dictionary version %u, expected %u\n",
+                filename, header.version, DICT_VERSION);
+        exit(1);
+    }
+    size_t expected = sizeof(header) + dict_offsets_size(header.num_words) + header.blob_size;
+    if ((size_t) st.st_size != expected) {
+        fprintf(stderr, "%s: compiled dictionary is %ld bytes, expected %lu\n",
+                filename, (long) st.st_size, (unsigned long) expected);
+        exit(1);
+    }
+    /* The buckets must cover the words exactly, in order of length, as
+       mkdict writes them; the loader copies them out back to back. */
+    uint64_t next = 0;
+    for (int len = 0; len <= DICT_MAX_LENGTH; len++) {
+        if (header.bucket_start[len] != next) {
+            fprintf(stderr, "%s: compiled dictionary has a bad bucket for length %d\n",
+                    filename, len);
+            exit(1);
+        }
+        next += header.bucket_size[len];
+    }
+    if (next != header.num_words) {
+        fprintf(stderr, "%s: compiled dictionary has %lu words in its buckets, expected %u\n",
+                filename, (unsigned long) next, header.num_words);
+        exit(1);
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    close(fd);
+
+    df->header = (const struct dict_header *) map;
+    df->offsets = (const uint32_t *) (map + sizeof(header));
+    df->blob = map + sizeof(header) + dict_offsets_size(header.num_words);
+    df->map_size = st.st_size;
+    int bad = check_dict_words(df);
+    if (bad != -1) {
+        fprintf(stderr, "%s: compiled dictionary has a bad offset for word %d\n",
+                filename, bad);
+        exit(1);
+    }
+    return 0;
+}
+
+
+/* Return 0 if the checksums in the header of the compiled dictionary df
+   match its contents, or -1 if it is corrupt. This reads the whole file.
+*/
+int verify_dict_file(struct dict_file *df) {
+    const struct dict_header *header = df->header;
+    size_t payload_size = df->map_size - sizeof(struct dict_header);
+    if (dict_checksum(df->offsets, payload_size) != header->checksum
+        || dict_checksum(df->blob, header->blob_size) != header->words_checksum) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Unmap the compiled dictionary mapped by open_dict_file. */
+void close_dict_file(struct dict_file *df) {
+    munmap((void *) df->header, df->map_size);
+    df->header = NULL;
+}
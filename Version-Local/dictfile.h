@@ -0,0 +1,67 @@
+#ifndef DICTFILE_H
+#define DICTFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compiled dictionary format, built by mkdict from a plain text
+   dictionary and mapped straight into memory by the games.
+
+   The file is laid out as:
+     - struct dict_header
+     - num_words uint32_t offsets into the blob, one per word, grouped by
+       length, padded with zeros to a multiple of 8 bytes
+     - the word blob: every word with its letter index in front of it,
+       exactly as read_dictionary lays out its arena (see struct word_index)
+   All fields are in the byte order of the machine that built the file.
+
+   Opening a compiled dictionary checks its header against the size of
+   the file, and that every word and its letter index lie in the blob, so
+   no file can make the games read outside it. The checksums, which also
+   catch corrupt letters, are only checked by mkdict -c.
+*/
+
+/* First bytes of every compiled dictionary. */
+#define DICT_MAGIC "HANGDICT"
+
+/* Bumped whenever the layout of the file changes. */
+#define DICT_VERSION 2
+
+/* Longest word a compiled dictionary can hold. */
+#define DICT_MAX_LENGTH 40
+
+struct dict_header {
+    char magic[8]; /* DICT_MAGIC, without the terminating '\0' */
+    uint32_t version; /* DICT_VERSION */
+    uint32_t num_words; /* Number of words, and of offsets */
+    uint64_t blob_size; /* Number of bytes in the word blob */
+    uint64_t checksum; /* dict_checksum of the offsets and the blob */
+    uint64_t words_checksum; /* dict_checksum of the blob alone */
+    uint32_t bucket_start[DICT_MAX_LENGTH + 1]; /* First offset of each length */
+    uint32_t bucket_size[DICT_MAX_LENGTH + 1]; /* Number of words of each length */
+};
+
+/* A compiled dictionary mapped into memory by open_dict_file. */
+struct dict_file {
+    const struct dict_header *header;
+    const uint32_t *offsets; /* Offset in blob of each word's first character */
+    const char *blob;
+    size_t map_size;
+};
+
+/* Return the number of bytes of the offset table for num_words words. */
+static inline size_t dict_offsets_size(uint32_t num_words) {
+    return ((size_t) num_words * sizeof(uint32_t) + 7) & ~(size_t) 7;
+}
+
+/* Return word i of the compiled dictionary df. */
+static inline const char *dict_file_word(struct dict_file *df, uint32_t i) {
+    return df->blob + df->offsets[i];
+}
+
+uint64_t dict_checksum(const void *data, size_t size);
+int open_dict_file(char *filename, struct dict_file *df);
+int verify_dict_file(struct dict_file *df);
+void close_dict_file(struct dict_file *df);
+
+#endif
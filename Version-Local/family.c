@@ -2,14 +2,178 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "family.h"
+#include "reading.h"
+#include "trace.h"
+#include "rows.h"
+#include "pool.h"
 
 /* Number of word pointers allocated for a new family.
    This is also the number of word pointers added to a family
-   using realloc, when the family is full.
+   when the family is full.
 */
 static int family_increment = 0;
 
+/* Number of buckets in the family index used by generate_families.
+   Must be a power of two.
+*/
+#define FAMILY_BUCKETS 4096
+
+/* Hash index from signature mask to family, so that generate_families can
+   find the family of a word without walking the whole family list.
+   Families in the same bucket are chained through bucket_next.
+   It is all NULL between partitions, and each thread has its own, so
+   several threads can partition words at the same time.
+*/
+static __thread Family *family_index[FAMILY_BUCKETS];
+
+/* Size of the first block of memory a family arena takes from malloc. */
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+/* A block of memory carved up by a family arena. */
+struct arena_block {
+    struct arena_block *next; /* Block filled before this one */
+    size_t size; /* Number of bytes in data */
+    size_t used; /* Number of bytes of data handed out */
+    char data[];
+};
+
+/* Arena from which all the families of one partition, their signatures
+   and their word pointers are allocated. Tearing the partition down is a
+   reset of the arena, and the arena is then kept in arena_pool for the
+   next partition, so a warmed-up arena makes no calls to malloc at all.
+*/
+struct fam_arena {
+    struct arena_block *blocks; /* Block being filled, then older blocks */
+    struct fam_arena *next_free; /* Next arena in arena_pool */
+    int in_use; /* 1 while some family lives in the arena */
+    int num_loose; /* Families of new_family still live in the arena */
+};
+
+/* Arenas that have been reset and are ready for another partition.
+   Each thread keeps its own pool.
+*/
+static __thread struct fam_arena *arena_pool = NULL;
+
+/* Arena that new_family takes families from, shared by all of them until
+   the last one is deallocated, or NULL. Each thread has its own.
+*/
+static __thread struct fam_arena *loose_arena = NULL;
+
+/* Key whose destructor frees a thread's arena_pool when the thread exits. */
+static pthread_key_t arena_pool_key;
+static pthread_once_t arena_pool_once = PTHREAD_ONCE_INIT;
+
+
+/* Return a new block of at least size bytes for an arena. */
+static struct arena_block *new_arena_block(size_t size) {
+    if (size < ARENA_BLOCK_SIZE) {
+        size = ARENA_BLOCK_SIZE;
+    }
+    struct arena_block *block = malloc(sizeof(struct arena_block) + size);
+    TRACE_ALLOC();
+    if (block == NULL) {
+        perror("malloc error in new_arena_block");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+
+/* Free the arenas in the calling thread's arena_pool. Arenas still in
+   use are left alone.
+*/
+static void free_arena_pool(void *unused) {
+    while (arena_pool != NULL) {
+        struct fam_arena *arena = arena_pool;
+        arena_pool = arena->next_free;
+        struct arena_block *block = arena->blocks;
+        while (block != NULL) {
+            struct arena_block *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(arena);
+    }
+}
+
+
+/* Create arena_pool_key, so threads other than main free their pools. */
+static void create_arena_pool_key(void) {
+    if (pthread_key_create(&arena_pool_key, free_arena_pool) != 0) {
+        perror("pthread_key_create");
+        exit(1);
+    }
+}
+
+
+/* Return an empty arena, taken from arena_pool if there is one. */
+static struct fam_arena *acquire_arena(void) {
+    struct fam_arena *arena = arena_pool;
+    if (arena != NULL) {
+        arena_pool = arena->next_free;
+    } else {
+        /* The key only needs a non-NULL value for its destructor to run. */
+        pthread_once(&arena_pool_once, create_arena_pool_key);
+        pthread_setspecific(arena_pool_key, &arena_pool);
+        arena = malloc(sizeof(struct fam_arena));
+        TRACE_ALLOC();
+        if (arena == NULL) {
+            perror("malloc error in acquire_arena");
+            exit(1);
+        }
+        arena->blocks = new_arena_block(ARENA_BLOCK_SIZE);
+    }
+    arena->in_use = 1;
+    arena->num_loose = 0;
+    return arena;
+}
+
+
+/* Reset arena, freeing everything allocated from it, and put it back
+   in arena_pool. If the partition overflowed into several blocks, they
+   are replaced by one block big enough for all of them, so the next
+   partition of the same size fits without growing.
+*/
+static void release_arena(struct fam_arena *arena) {
+    struct arena_block *block = arena->blocks;
+    if (block->next != NULL) {
+        size_t total = 0;
+        while (block != NULL) {
+            struct arena_block *next = block->next;
+            total += block->size;
+            free(block);
+            block = next;
+        }
+        arena->blocks = new_arena_block(total);
+    } else {
+        block->used = 0;
+    }
+    arena->in_use = 0;
+    arena->next_free = arena_pool;
+    arena_pool = arena;
+}
+
+
+/* Return size bytes (aligned for any family field) from arena. */
+static void *arena_alloc(struct fam_arena *arena, size_t size) {
+    struct arena_block *block = arena->blocks;
+    size = (size + 7) & ~(size_t) 7;
+    if (block->size - block->used < size) {
+        block = new_arena_block(block->size * 2 > size ? block->size * 2 : size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
 
 /* Set family_increment to size, and initialize random number generator.
    The random number generator is used to select a random word from a family.
@@ -30,7 +194,7 @@ void print_families(Family *fam_list) {
 
     while (fam) {
         printf("***Family signature: %s Num words: %d\n",
-               fam->signature, fam->num_words);
+               get_family_signature(fam), fam->num_words);
         for (i = 0; i < fam->num_words; i++) {
             printf("     %s\n", fam->word_ptrs[i]);
         }
@@ -40,56 +204,94 @@ void print_families(Family *fam_list) {
 }
 
 
+/* Return a pointer to a new family, allocated from arena, whose
+   signature has letter at the positions set in mask and is length
+   characters long. The dashed form of the signature is not built until
+   get_family_signature asks for it.
+   Initialize word_ptrs to point to max_words+1 NULL pointers (or to NULL
+   if max_words is 0, for a family whose words are placed later),
+   numwords to 0, max_words to max_words, and next to NULL.
+*/
+static Family *new_family_from_mask(struct fam_arena *arena, uint64_t mask,
+                                    int length, char letter, int max_words) {
+    Family *new_family_ptr = arena_alloc(arena, sizeof(Family));
+    new_family_ptr->mask = mask;
+    new_family_ptr->length = length;
+    new_family_ptr->letter = letter;
+    new_family_ptr->signature = NULL;
+    new_family_ptr->word_ptrs = NULL;
+    if (max_words > 0) {
+        new_family_ptr->word_ptrs = arena_alloc(arena, sizeof(char *) * (max_words + 1));
+        for (int i = 0; i < max_words + 1; i++) {
+            new_family_ptr->word_ptrs[i] = NULL;
+        }
+    }
+    new_family_ptr->num_words = 0;
+    new_family_ptr->max_words = max_words;
+    new_family_ptr->next = NULL;
+    new_family_ptr->bucket_next = NULL;
+    new_family_ptr->arena = arena;
+    return new_family_ptr;
+}
+
+
+/* Parse the signature str (e.g. ---e) into the mask of positions that
+   hold a letter. Store the signature length in length and the letter
+   in letter ('\0' if the signature is all dashes).
+*/
+static uint64_t parse_signature(char *str, int *length, char *letter) {
+    uint64_t mask = 0;
+    int i;
+    *letter = '\0';
+    for (i = 0; str[i] != '\0'; i++) {
+        if (str[i] != '-') {
+            mask |= (uint64_t) 1 << i;
+            *letter = str[i];
+        }
+    }
+    *length = i;
+    return mask;
+}
+
+
 /* Return a pointer to a new family whose signature is 
    a copy of str. Initialize word_ptrs to point to 
    family_increment+1 pointers, numwords to 0, 
    max_words to family_increment, and next to NULL.
+   Every family made by new_family comes out of the same arena, like the
+   families of one partition of generate_families, and the arena is
+   reset once all of them have been deallocated, usually once a round.
 */
 Family *new_family(char *str) {
-    Family *new_family_ptr = malloc(sizeof(Family));
-    if (new_family_ptr == NULL) {
-        perror("malloc error new family pointer in new_family");
-        exit(1);
-    }
-    new_family_ptr->signature = malloc((strlen(str) + 1) * sizeof(char));
-    if (new_family_ptr->signature == NULL) {
-        perror("malloc error in signature in new_family");
-        exit(1);
-    }
-    strcpy(new_family_ptr->signature, str);
-    new_family_ptr->word_ptrs = malloc(sizeof(char *) * (family_increment + 1));
-    if (new_family_ptr->word_ptrs == NULL) {
-        perror("malloc error in words in new_family");
-        exit(1);
+    int length;
+    char letter;
+    uint64_t mask = parse_signature(str, &length, &letter);
+    if (loose_arena == NULL) {
+        loose_arena = acquire_arena();
     }
-    for (int i = 0; i < family_increment + 1; i++) {
-        new_family_ptr->word_ptrs[i] = NULL;
-    }
-    new_family_ptr->num_words = 0;
-    new_family_ptr->max_words = family_increment;
-    new_family_ptr->next = NULL;
-    return new_family_ptr;
+    loose_arena->num_loose++;
+    return new_family_from_mask(loose_arena, mask, length, letter, family_increment);
 }
 
 
 /* Add word to the next free slot fam->word_ptrs.
-   If fam->word_ptrs is full, first use realloc to allocate family_increment
-   more pointers and then add the new pointer.
+   If fam->word_ptrs is full, first move the pointers to a new array with
+   family_increment more pointers, taken from the family's arena, and
+   then add the new pointer. The old array is reclaimed with the arena.
+   Families made by generate_families are sized exactly and never grow.
 */
 void add_word_to_family(Family *fam, char *word) {
-    if ((fam->max_words) > (fam->num_words)) {
-        fam->word_ptrs[fam->num_words] = word;
-    } else {
-        fam->word_ptrs = realloc(fam->word_ptrs, sizeof(char *) * (fam->max_words + family_increment + 1));
-        if (fam->word_ptrs == NULL) {
-            perror("realloc error in add_word_to_family");
-            exit(1);
+    if (fam->num_words >= fam->max_words) {
+        int max_words = fam->max_words + family_increment;
+        char **word_ptrs = arena_alloc(fam->arena, sizeof(char *) * (max_words + 1));
+        memcpy(word_ptrs, fam->word_ptrs, sizeof(char *) * fam->num_words);
+        for (int i = fam->num_words; i < max_words + 1; i++) {
+            word_ptrs[i] = NULL;
         }
-        fam->word_ptrs[fam->max_words + family_increment] = NULL; // The last one
-        fam->word_ptrs[fam->max_words + 1] = NULL; // The next one
-        fam->max_words += family_increment;
-        fam->word_ptrs[fam->num_words] = word;
+        fam->word_ptrs = word_ptrs;
+        fam->max_words = max_words;
     }
+    fam->word_ptrs[fam->num_words] = word;
     fam->num_words += 1;
 }
 
@@ -99,9 +301,12 @@ void add_word_to_family(Family *fam, char *word) {
    fam_list is a pointer to the head of a list of Family nodes.
 */
 Family *find_family(Family *fam_list, char *sig) {
+    int length;
+    char letter;
+    uint64_t mask = parse_signature(sig, &length, &letter);
     Family *cur_fam = fam_list;
     while (cur_fam != NULL) {
-        if (strcmp(cur_fam->signature, sig) == 0) {
+        if (cur_fam->mask == mask && cur_fam->length == length) {
             return cur_fam;
         }
         cur_fam = cur_fam->next;
@@ -128,14 +333,32 @@ Family *find_biggest_family(Family *fam_list) {
 }
 
 
-/* Deallocate all memory rooted in the List pointed to by fam_list. */
+/* Deallocate all memory rooted in the List pointed to by fam_list.
+   Every family lives in an arena, so this resets the arenas of the
+   families rather than freeing them one by one. The arenas are gathered
+   first, since resetting one may free memory that later families use.
+   The arena of new_family is only reset with the last of its families.
+*/
 void deallocate_families(Family *fam_list) {
-    while (fam_list != NULL) {
-        Family *next = fam_list->next;
-        free(fam_list->signature);
-        free(fam_list->word_ptrs);
-        free(fam_list);
-        fam_list = next;
+    struct fam_arena *to_release = NULL;
+    for (; fam_list != NULL; fam_list = fam_list->next) {
+        struct fam_arena *arena = fam_list->arena;
+        if (arena->num_loose > 0 && --arena->num_loose > 0) {
+            continue;
+        }
+        if (arena == loose_arena) {
+            loose_arena = NULL;
+        }
+        if (arena->in_use) {
+            arena->in_use = 0;
+            arena->next_free = to_release;
+            to_release = arena;
+        }
+    }
+    while (to_release != NULL) {
+        struct fam_arena *next = to_release->next_free;
+        release_arena(to_release);
+        to_release = next;
     }
 }
 
@@ -143,70 +366,567 @@ void deallocate_families(Family *fam_list) {
     - returns 1 if it contains such letter
     - returns 0 if it does not
 	
-	This is a helper function to speed up whether or not if we need
-	to extract the signature, by calling extract_signature.
+	This is a lookup in the letter index built by read_dictionary.
 */
 int contains(char *word, char letter) {
-    int i = 0;
-    while (word[i] != '\0') {
-        if (word[i] == letter) {
-            return 1;
-        }
-        i += 1;
-    }
-    return 0;
+    unsigned int bit = letter - 'a';
+    return bit < 26 && (word_letters(word) >> bit) & 1;
+}
+
+/* Return the signature mask of word, partitioning using letter:
+   bit i is set if word[i] is letter. Store the length of word in length.
+   Both come from the letter index built by read_dictionary, so no character
+   of the word is scanned.
+*/
+static uint64_t extract_signature(char *word, char letter, int *length) {
+    *length = word_length(word);
+    return word_letter_positions(word, letter);
+}
+
+/* Return the family_index bucket of the signature mask (Fibonacci hash). */
+static unsigned int signature_bucket(uint64_t mask) {
+    return (unsigned int) ((mask * 0x9E3779B97F4A7C15ULL) >> 52) & (FAMILY_BUCKETS - 1);
 }
 
-/* Extract the signature of word, partitioning using letter. Store
-the result through the char array pointer signature. This way I 
-don't have to use heap to exchange the signature information.
+/* Return a linked list of the families of the num_words words in
+   word_list, partitioned using letter, allocated from arena. Store the
+   family of word_list[i] in family_of[i]. Each family's max_words is
+   set to its number of words; its word_ptrs is left for the caller.
+   Each family is also entered into family_index, so finding the family
+   of a word takes expected constant time instead of a walk of the list.
+   Store the number of families in num_families.
+   If masks is not NULL, masks[i] is the signature mask of word_list[i]
+   and the words all have the same length; otherwise the masks come from
+   the letter index.
 */
-void extract_signature(char *word, char letter, char *signature) {
-    for (int i = 0; i < strlen(word); i++) {
-        if (word[i] == letter) {
-            signature[i] = letter;
+static Family *count_families(char **word_list, int num_words, char letter,
+                              const uint64_t *masks, struct fam_arena *arena,
+                              Family **family_of, int *num_families) {
+    Family *families = NULL;
+    int length = word_length(word_list[0]);
+    *num_families = 0;
+    for (int i = 0; i < num_words; i++) {
+        uint64_t mask;
+        if (masks != NULL) {
+            mask = masks[i];
         } else {
-            signature[i] = '-';
+            mask = extract_signature(word_list[i], letter, &length);
         }
+        unsigned int bucket = signature_bucket(mask);
+        Family *existing = family_index[bucket];
+        while (existing != NULL && (existing->mask != mask || existing->length != length)) {
+            existing = existing->bucket_next;
+        }
+        if (existing == NULL) {
+            existing = new_family_from_mask(arena, mask, length, letter, 0);
+            existing->next = families;
+            families = existing;
+            existing->bucket_next = family_index[bucket];
+            family_index[bucket] = existing;
+            *num_families += 1;
+        }
+        existing->max_words++;
+        family_of[i] = existing;
     }
-    signature[strlen(word)] = '\0';
+    /* Empty only the buckets used, rather than the whole index, so that
+       partitioning a handful of words stays cheap. */
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        family_index[signature_bucket(fam->mask)] = NULL;
+    }
+    return families;
 }
 
 /* Generate and return a linked list of all families using words pointed to
    by word_list, using letter to partition the words.
+   All the families come out of one arena, which deallocate_families resets.
+
+   The partition is a counting sort by signature: a first pass finds the
+   family of every word and counts the families' sizes, then every family
+   gets an exactly sized slice of one shared word pointer array, and a
+   second pass places the words. So no family is ever grown, and a family
+   of one word costs two pointers instead of family_increment+1.
 */
 Family *generate_families(char **word_list, char letter) {
-    int i = 0;
-    /* extarcted_sig is to store the signature of the word that we
-    are currentlt looking at, partitione used letter */
-    char extracted_sig[128];
-    extract_signature(word_list[i], letter, extracted_sig);
-    Family *families = new_family(extracted_sig);
-    add_word_to_family(families, word_list[i]);
-    i += 1;
-    while (word_list[i] != NULL) {
-        extract_signature(word_list[i], letter, extracted_sig);
-        Family *existing = find_family(families, extracted_sig);
-        if (existing == NULL) {
-            Family *new_fam = new_family(extracted_sig);
-            add_word_to_family(new_fam, word_list[i]);
-            new_fam->next = families;
-            families = new_fam;
+    int num_words = 0;
+    while (word_list[num_words] != NULL) {
+        num_words++;
+    }
+    if (num_words == 0) {
+        return NULL;
+    }
+    struct fam_arena *arena = acquire_arena();
+    Family **family_of = arena_alloc(arena, sizeof(Family *) * num_words);
+    int num_families;
+    Family *families = count_families(word_list, num_words, letter, NULL, arena,
+                                      family_of, &num_families);
+
+    /* Give every family its slice, with room for its terminating NULL. */
+    char **slice = arena_alloc(arena, sizeof(char *) * (num_words + num_families));
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        fam->word_ptrs = slice;
+        fam->word_ptrs[fam->max_words] = NULL;
+        slice += fam->max_words + 1;
+    }
+
+    /* Placement pass: every family has exactly the room it needs. */
+    for (int i = 0; i < num_words; i++) {
+        add_word_to_family(family_of[i], word_list[i]);
+    }
+    return families;
+}
+
+
+/* Move word i of word_list to index slot_of[i], for all num_words words,
+   by following the cycles of slot_of: every swap puts one word (and its
+   row, if rows is not NULL) where it belongs, so the words and rows are
+   reordered in place, with no copy of either. slot_of is left as 0, 1, ...
+*/
+static void move_to_slots(char **word_list, Rows *rows, int num_words, int *slot_of) {
+    char row[64];
+    for (int i = 0; i < num_words; i++) {
+        while (slot_of[i] != i) {
+            int slot = slot_of[i];
+            char *word = word_list[i];
+            word_list[i] = word_list[slot];
+            word_list[slot] = word;
+            slot_of[i] = slot_of[slot];
+            slot_of[slot] = slot;
+            if (rows != NULL) {
+                char *at_i = rows->data + (size_t) i * rows->stride;
+                char *at_slot = rows->data + (size_t) slot * rows->stride;
+                memcpy(row, at_i, rows->stride);
+                memcpy(at_i, at_slot, rows->stride);
+                memcpy(at_slot, row, rows->stride);
+            }
+        }
+    }
+}
+
+
+/* Signatures in a chunk table start with room for this many. */
+#define CHUNK_TABLE_SIZE 64
+
+/* One thread's share of the words of generate_families_parallel or
+   partition_rows_parallel, and the partial family table it builds for
+   them: every distinct signature of the chunk, in order of first
+   occurrence, with its word count.
+*/
+struct chunk {
+    char **words;
+    int start; /* Index of words[0] in the whole word list */
+    int num_words;
+    char letter;
+    int *word_signature; /* Index in signatures of each word's signature */
+    uint64_t *signatures; /* Mask, with the word length in bits 48 and up */
+    int *counts; /* Words of the chunk with each signature */
+    Family **families; /* Family of each signature, filled in by the merge */
+    int *next_slot; /* Next index in its family's word_ptrs for each signature */
+    int num_signatures;
+    int *table; /* Open addressing from signature to index; -1 is empty */
+    int capacity; /* Power of two, at least twice num_signatures */
+};
+
+/* The chunks of one parallel partition. */
+struct chunked_words {
+    struct chunk *chunks;
+    int num_chunks;
+    char **word_list; /* All the words */
+    Rows *rows; /* Their rows, or NULL to use the letter index */
+    uint64_t *masks; /* Signature mask of every word, if rows is not NULL */
+    int *slot_of; /* Index in word_list every word moves to, for partition_rows_parallel */
+};
+
+
+/* Return a new array of size bytes for a chunk, or terminate. */
+static void *chunk_alloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    TRACE_ALLOC();
+    if (ptr == NULL) {
+        perror("realloc error in a parallel partition");
+        exit(1);
+    }
+    return ptr;
+}
+
+
+/* Return the slot of signature in a chunk table of any size, from the
+   same Fibonacci hash as signature_bucket but with all 32 of its bits.
+*/
+static unsigned int chunk_slot(uint64_t signature) {
+    return (unsigned int) ((signature * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+
+/* Return the index of signature in chunk's table, adding it with a
+   count of 0 if it is new.
+*/
+static int chunk_signature(struct chunk *chunk, uint64_t signature) {
+    if (2 * (chunk->num_signatures + 1) > chunk->capacity) {
+        int old_capacity = chunk->capacity;
+        chunk->capacity = old_capacity > 0 ? old_capacity * 2 : CHUNK_TABLE_SIZE;
+        chunk->table = chunk_alloc(chunk->table, sizeof(int) * chunk->capacity);
+        chunk->signatures = chunk_alloc(chunk->signatures,
+                                        sizeof(uint64_t) * chunk->capacity / 2);
+        chunk->counts = chunk_alloc(chunk->counts, sizeof(int) * chunk->capacity / 2);
+        for (int slot = 0; slot < chunk->capacity; slot++) {
+            chunk->table[slot] = -1;
+        }
+        for (int index = 0; index < chunk->num_signatures; index++) {
+            unsigned int slot = chunk_slot(chunk->signatures[index]);
+            while (chunk->table[slot & (chunk->capacity - 1)] != -1) {
+                slot++;
+            }
+            chunk->table[slot & (chunk->capacity - 1)] = index;
+        }
+    }
+    unsigned int slot = chunk_slot(signature);
+    while (1) {
+        int index = chunk->table[slot & (chunk->capacity - 1)];
+        if (index == -1) {
+            index = chunk->num_signatures++;
+            chunk->table[slot & (chunk->capacity - 1)] = index;
+            chunk->signatures[index] = signature;
+            chunk->counts[index] = 0;
+            return index;
+        }
+        if (chunk->signatures[index] == signature) {
+            return index;
+        }
+        slot++;
+    }
+}
+
+
+/* Pool task: build the partial family table of chunk number task. The
+   masks come from the rows of the words if there are any.
+*/
+static void count_chunk(void *context, int task) {
+    struct chunked_words *chunked = context;
+    struct chunk *chunk = &chunked->chunks[task];
+    uint64_t *masks = NULL;
+    int length = word_length(chunk->words[0]);
+    if (chunked->rows != NULL) {
+        Rows *rows = chunked->rows;
+        masks = chunked->masks + chunk->start;
+        rows->kernel(rows->data + (size_t) chunk->start * rows->stride, chunk->num_words,
+                     rows->stride, chunk->letter, masks);
+    }
+    chunk->word_signature = chunk_alloc(NULL, sizeof(int) * chunk->num_words);
+    for (int i = 0; i < chunk->num_words; i++) {
+        uint64_t mask;
+        if (masks != NULL) {
+            mask = masks[i];
         } else {
-            add_word_to_family(existing, word_list[i]);
+            mask = extract_signature(chunk->words[i], chunk->letter, &length);
         }
-        i += 1;
+        int index = chunk_signature(chunk, mask | (uint64_t) length << 48);
+        chunk->counts[index]++;
+        chunk->word_signature[i] = index;
+    }
+}
+
+
+/* Pool task: place the words of chunk number task in their families. */
+static void place_chunk(void *context, int task) {
+    struct chunk *chunk = &((struct chunked_words *) context)->chunks[task];
+    for (int i = 0; i < chunk->num_words; i++) {
+        int index = chunk->word_signature[i];
+        chunk->families[index]->word_ptrs[chunk->next_slot[index]++] = chunk->words[i];
+    }
+}
+
+
+/* Pool task: find the index in the word list that every word of chunk
+   number task moves to, in the range of its family.
+*/
+static void slot_chunk(void *context, int task) {
+    struct chunked_words *chunked = context;
+    struct chunk *chunk = &chunked->chunks[task];
+    for (int i = 0; i < chunk->num_words; i++) {
+        int index = chunk->word_signature[i];
+        Family *owner = chunk->families[index];
+        chunked->slot_of[chunk->start + i] = owner->word_ptrs - chunked->word_list
+                                             + chunk->next_slot[index]++;
+    }
+}
+
+
+/* Split the num_words words of word_list into one chunk per thread of
+   pool, and build the chunks' family tables in parallel. Return the
+   chunks, to be freed by free_chunks.
+*/
+static struct chunked_words split_chunks(char **word_list, Rows *rows, uint64_t *masks,
+                                         int num_words, char letter, struct pool *pool) {
+    struct chunked_words chunked;
+    chunked.num_chunks = get_pool_size(pool);
+    chunked.word_list = word_list;
+    chunked.rows = rows;
+    chunked.masks = masks;
+    chunked.slot_of = NULL;
+    chunked.chunks = calloc(chunked.num_chunks, sizeof(struct chunk));
+    TRACE_ALLOC();
+    if (chunked.chunks == NULL) {
+        perror("calloc error in a parallel partition");
+        exit(1);
+    }
+    for (int c = 0; c < chunked.num_chunks; c++) {
+        struct chunk *chunk = &chunked.chunks[c];
+        chunk->start = (long) num_words * c / chunked.num_chunks;
+        chunk->words = word_list + chunk->start;
+        chunk->num_words = (long) num_words * (c + 1) / chunked.num_chunks - chunk->start;
+        chunk->letter = letter;
+    }
+    pool_run(pool, count_chunk, &chunked, chunked.num_chunks);
+    return chunked;
+}
+
+
+/* Merge the family tables of the chunks of chunked into a list of
+   families allocated from arena, and return it. Families are made in
+   order of first occurrence, as in count_families, so the list is the
+   one a serial partition makes. Each family's max_words is its number
+   of words, and each chunk's next_slot starts after the earlier chunks'
+   words of the family. Store the number of families in num_families.
+*/
+static Family *merge_chunks(struct chunked_words *chunked, struct fam_arena *arena,
+                            char letter, int *num_families) {
+    Family *families = NULL;
+    *num_families = 0;
+    for (int c = 0; c < chunked->num_chunks; c++) {
+        struct chunk *chunk = &chunked->chunks[c];
+        chunk->families = chunk_alloc(NULL, sizeof(Family *) * chunk->num_signatures);
+        chunk->next_slot = chunk_alloc(NULL, sizeof(int) * chunk->num_signatures);
+        for (int index = 0; index < chunk->num_signatures; index++) {
+            uint64_t mask = chunk->signatures[index] & (((uint64_t) 1 << 48) - 1);
+            int length = chunk->signatures[index] >> 48;
+            unsigned int bucket = signature_bucket(mask);
+            Family *existing = family_index[bucket];
+            while (existing != NULL && (existing->mask != mask || existing->length != length)) {
+                existing = existing->bucket_next;
+            }
+            if (existing == NULL) {
+                existing = new_family_from_mask(arena, mask, length, letter, 0);
+                existing->next = families;
+                families = existing;
+                existing->bucket_next = family_index[bucket];
+                family_index[bucket] = existing;
+                *num_families += 1;
+            }
+            chunk->families[index] = existing;
+            chunk->next_slot[index] = existing->max_words;
+            existing->max_words += chunk->counts[index];
+        }
+    }
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        family_index[signature_bucket(fam->mask)] = NULL;
+    }
+    return families;
+}
+
+
+/* Free the chunks made by split_chunks. */
+static void free_chunks(struct chunked_words *chunked) {
+    for (int c = 0; c < chunked->num_chunks; c++) {
+        struct chunk *chunk = &chunked->chunks[c];
+        free(chunk->word_signature);
+        free(chunk->signatures);
+        free(chunk->counts);
+        free(chunk->families);
+        free(chunk->next_slot);
+        free(chunk->table);
+    }
+    free(chunked->chunks);
+}
+
+
+/* Like generate_families, but the words are split into one chunk per
+   thread of pool, whose signatures are found and counted in parallel.
+   The chunks' tables are then merged on the calling thread in chunk
+   order, which meets every family in the order generate_families does,
+   and every chunk gets the range of each family's slice that follows
+   the earlier chunks' words. So the words are placed in parallel too,
+   and the families come out exactly as generate_families makes them.
+   Below PARALLEL_MIN_WORDS words, or with one thread, this is just
+   generate_families.
+*/
+Family *generate_families_parallel(char **word_list, char letter, struct pool *pool) {
+    int num_words = 0;
+    while (word_list[num_words] != NULL) {
+        num_words++;
+    }
+    if (num_words < PARALLEL_MIN_WORDS || get_pool_size(pool) == 1) {
+        return generate_families(word_list, letter);
+    }
+
+    struct chunked_words chunked = split_chunks(word_list, NULL, NULL, num_words, letter, pool);
+    struct fam_arena *arena = acquire_arena();
+    int num_families;
+    Family *families = merge_chunks(&chunked, arena, letter, &num_families);
+
+    /* Give every family its slice, with room for its terminating NULL. */
+    char **slice = arena_alloc(arena, sizeof(char *) * (num_words + num_families));
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        fam->word_ptrs = slice;
+        fam->word_ptrs[fam->max_words] = NULL;
+        fam->num_words = fam->max_words;
+        slice += fam->max_words + 1;
     }
+    pool_run(pool, place_chunk, &chunked, chunked.num_chunks);
+    free_chunks(&chunked);
     return families;
 }
 
 
-/* Return the signature of the family pointed to by fam. */
+/* Partition the num_words words of word_list in place using letter, and
+   return a linked list of the families, allocated from arena. If rows is
+   not NULL, it holds the words packed as by new_rows; the masks then come
+   from its kernel, and its rows are reordered along with word_list. See
+   partition_families, partition_rows and partition_copy.
+*/
+static Family *partition(struct fam_arena *arena, char **word_list, Rows *rows,
+                         int num_words, char letter) {
+    Family **family_of = arena_alloc(arena, sizeof(Family *) * num_words);
+    uint64_t *masks = NULL;
+    if (rows != NULL) {
+        masks = arena_alloc(arena, sizeof(uint64_t) * num_words);
+        rows->kernel(rows->data, num_words, rows->stride, letter, masks);
+    }
+    int num_families;
+    Family *families = count_families(word_list, num_words, letter, masks, arena,
+                                      family_of, &num_families);
+
+    /* Lay the ranges out in list order, and find the slot of every word:
+       the next free one of its family, so each family keeps its words in
+       list order. That is the order the original list-building engine
+       had, and the order extract_family leaves, so narrowing by a cached
+       choice gives the same candidates as partitioning.
+    */
+    char **range = word_list;
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        fam->word_ptrs = range;
+        range += fam->max_words;
+    }
+    int *slot_of = arena_alloc(arena, sizeof(int) * num_words);
+    for (int i = 0; i < num_words; i++) {
+        Family *owner = family_of[i];
+        slot_of[i] = owner->word_ptrs - word_list + owner->num_words++;
+    }
+
+    move_to_slots(word_list, rows, num_words, slot_of);
+    return families;
+}
+
+
+/* Partition the num_words words of word_list in place using letter, and
+   return a linked list of the families. Unlike generate_families, no
+   family gets its own copy of its words: word_list is reordered, keeping
+   the order of each family's words, so that every family is a
+   contiguous range of it, and each family's word_ptrs points at the start
+   of its range. These ranges are not NULL-terminated; use num_words.
+
+   So the words of the next guess are just the range of the chosen family,
+   and narrowing the candidates needs no get_new_word_list copy. The
+   families are only valid while word_list is not reordered again outside
+   their range.
+*/
+Family *partition_families(char **word_list, int num_words, char letter) {
+    if (num_words == 0) {
+        return NULL;
+    }
+    return partition(acquire_arena(), word_list, NULL, num_words, letter);
+}
+
+
+/* Like partition_families, but word_list is left as it is: the families
+   are ranges of a copy of it, taken from the same arena as the families,
+   so deallocate_families releases the copy along with them.
+*/
+Family *partition_copy(char **word_list, int num_words, char letter) {
+    if (num_words == 0) {
+        return NULL;
+    }
+    struct fam_arena *arena = acquire_arena();
+    char **copy = arena_alloc(arena, sizeof(char *) * num_words);
+    memcpy(copy, word_list, sizeof(char *) * num_words);
+    return partition(arena, copy, NULL, num_words, letter);
+}
+
+
+/* Like partition_families, for words that all have the same length and
+   are also packed into rows by new_rows, in the order of word_list.
+   The signatures are found by the kernel of rows, which compares whole
+   rows, and the rows are reordered along with word_list, so the rows
+   of every family stay a range of them too.
+*/
+Family *partition_rows(char **word_list, Rows *rows, int num_words, char letter) {
+    if (num_words == 0) {
+        return NULL;
+    }
+    return partition(acquire_arena(), word_list, rows, num_words, letter);
+}
+
+
+/* Like partition_rows, but with the signatures found, counted and given
+   their slots in parallel, on one chunk of the words per thread of pool.
+   The words and rows are then moved to their slots in place. Chunks are
+   merged in order, so the families, and the order of their words, are
+   exactly those of partition_rows. Below PARALLEL_MIN_WORDS words, or
+   with one thread, this is just partition_rows.
+*/
+Family *partition_rows_parallel(char **word_list, Rows *rows, int num_words, char letter,
+                                struct pool *pool) {
+    if (num_words < PARALLEL_MIN_WORDS || get_pool_size(pool) == 1) {
+        return partition_rows(word_list, rows, num_words, letter);
+    }
+    struct fam_arena *arena = acquire_arena();
+    uint64_t *masks = arena_alloc(arena, sizeof(uint64_t) * num_words);
+    struct chunked_words chunked = split_chunks(word_list, rows, masks, num_words, letter, pool);
+    int num_families;
+    Family *families = merge_chunks(&chunked, arena, letter, &num_families);
+
+    /* Lay the ranges out in list order, as partition does. */
+    char **range = word_list;
+    for (Family *fam = families; fam != NULL; fam = fam->next) {
+        fam->word_ptrs = range;
+        fam->num_words = fam->max_words;
+        range += fam->max_words;
+    }
+    chunked.slot_of = arena_alloc(arena, sizeof(int) * num_words);
+    pool_run(pool, slot_chunk, &chunked, chunked.num_chunks);
+    move_to_slots(word_list, rows, num_words, chunked.slot_of);
+    free_chunks(&chunked);
+    return families;
+}
+
+
+/* Return the signature of the family pointed to by fam.
+   The dashed string is rendered from the mask the first time it is
+   asked for and kept until the family is deallocated.
+*/
 char *get_family_signature(Family *fam) {
+    if (fam->signature == NULL) {
+        fam->signature = arena_alloc(fam->arena, (fam->length + 1) * sizeof(char));
+        for (int i = 0; i < fam->length; i++) {
+            if (fam->mask & ((uint64_t) 1 << i)) {
+                fam->signature[i] = fam->letter;
+            } else {
+                fam->signature[i] = '-';
+            }
+        }
+        fam->signature[fam->length] = '\0';
+    }
     return fam->signature;
 }
 
 
+/* Return the signature mask of the family pointed to by fam:
+   bit i is set if position i of the family's words holds the letter.
+*/
+uint64_t get_family_mask(Family *fam) {
+    return fam->mask;
+}
+
+
 /* Return a pointer to word pointers, each of which
    points to a word in fam. These pointers should not be the same
    as those used by fam->word_ptrs (i.e. they should be independently malloc'd),
@@ -238,3 +958,514 @@ char *get_random_word_from_family(Family *fam) {
     int chosen_index = rand() % family_word_count;
     return (fam->word_ptrs)[chosen_index];
 }
+
+
+/* Open addressing table from signature mask to family size, used by
+   generate_histograms for one letter. Key 0 marks an empty slot, since
+   words without the letter are not entered.
+*/
+struct hist_table {
+    uint64_t *keys;
+    int *counts;
+    int capacity; /* Power of two */
+    int size; /* Number of keys in the table */
+    int total; /* Number of words entered */
+};
+
+/* Initial number of slots in each letter's hist_table. */
+#define HIST_TABLE_SIZE 16
+
+
+/* Make table empty, with capacity slots taken from arena. */
+static void init_hist_table(struct hist_table *table, int capacity,
+                            struct fam_arena *arena) {
+    table->keys = arena_alloc(arena, sizeof(uint64_t) * capacity);
+    table->counts = arena_alloc(arena, sizeof(int) * capacity);
+    memset(table->keys, 0, sizeof(uint64_t) * capacity);
+    table->capacity = capacity;
+    table->size = 0;
+    table->total = 0;
+}
+
+
+/* Add count words with signature mask (not 0) to table. */
+static void hist_table_add(struct hist_table *table, uint64_t mask, int count,
+                           struct fam_arena *arena) {
+    if (table->size * 2 >= table->capacity) {
+        /* Rehash into twice the slots; the old ones go with the arena. */
+        struct hist_table old = *table;
+        init_hist_table(table, old.capacity * 2, arena);
+        for (int i = 0; i < old.capacity; i++) {
+            if (old.keys[i] != 0) {
+                hist_table_add(table, old.keys[i], old.counts[i], arena);
+            }
+        }
+        table->total = old.total;
+    }
+    unsigned int slot = (mask * 0x9E3779B97F4A7C15ULL) >> 40;
+    slot &= table->capacity - 1;
+    while (table->keys[slot] != 0 && table->keys[slot] != mask) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    if (table->keys[slot] == 0) {
+        table->keys[slot] = mask;
+        table->counts[slot] = 0;
+        table->size++;
+    }
+    table->counts[slot] += count;
+    table->total += count;
+}
+
+
+/* Return an array of 26 histograms, one per letter from 'a' to 'z',
+   giving the families that guessing that letter would split the
+   num_words words of word_list into. Letters whose bit is set in skip
+   (bit i for 'a' + i), usually the ones already guessed, are left empty.
+
+   This takes a single pass over the words, reading the position masks
+   from each word's letter index and only visiting the letters the word
+   contains. The "no letter" family of each letter is not counted per
+   word at all: it is whatever is left of num_words. So this is much
+   cheaper than partitioning the words once per letter.
+*/
+Histogram *generate_histograms(char **word_list, int num_words, uint32_t skip) {
+    struct fam_arena *arena = acquire_arena();
+    struct hist_table tables[26];
+    for (int bit = 0; bit < 26; bit++) {
+        init_hist_table(&tables[bit], HIST_TABLE_SIZE, arena);
+    }
+
+    for (int i = 0; i < num_words; i++) {
+        uint32_t letters = word_letters(word_list[i]);
+        const uint64_t *mask = word_letter_masks(word_list[i]);
+        for (; letters != 0; letters &= letters - 1, mask++) {
+            int bit = __builtin_ctz(letters);
+            if (!(skip & (1u << bit))) {
+                hist_table_add(&tables[bit], *mask, 1, arena);
+            }
+        }
+    }
+
+    Histogram *hists = arena_alloc(arena, sizeof(Histogram) * 26);
+    for (int bit = 0; bit < 26; bit++) {
+        Histogram *hist = &hists[bit];
+        struct hist_table *table = &tables[bit];
+        hist->letter = 'a' + bit;
+        hist->num_families = 0;
+        hist->biggest = 0;
+        hist->arena = arena;
+        if (skip & (1u << bit)) {
+            hist->masks = NULL;
+            hist->counts = NULL;
+            continue;
+        }
+        int absent = num_words - table->total;
+        int max_families = table->size + (absent > 0);
+        hist->masks = arena_alloc(arena, sizeof(uint64_t) * max_families);
+        hist->counts = arena_alloc(arena, sizeof(int) * max_families);
+        if (absent > 0) {
+            hist->masks[0] = 0;
+            hist->counts[0] = absent;
+            hist->num_families = 1;
+        }
+        for (int slot = 0; slot < table->capacity; slot++) {
+            if (table->keys[slot] != 0) {
+                int fam = hist->num_families++;
+                hist->masks[fam] = table->keys[slot];
+                hist->counts[fam] = table->counts[slot];
+                if (hist->counts[fam] > hist->counts[hist->biggest]) {
+                    hist->biggest = fam;
+                }
+            }
+        }
+    }
+    return hists;
+}
+
+
+/* Deallocate the histograms made by generate_histograms. */
+void deallocate_histograms(Histogram *hists) {
+    release_arena(hists[0].arena);
+}
+
+
+/* Move the words of word_list whose positions of letter are exactly mask
+   to its front, keeping their order, and return them as a family. If
+   rows is not NULL, it holds the words packed as by new_rows and its
+   rows are reordered along with word_list. See extract_family and
+   extract_rows.
+*/
+static Family *extract(char **word_list, Rows *rows, int num_words, char letter,
+                       uint64_t mask) {
+    struct fam_arena *arena = acquire_arena();
+    int length = num_words > 0 ? word_length(word_list[0]) : 0;
+    Family *fam = new_family_from_mask(arena, mask, length, letter, 0);
+    uint64_t *masks = NULL;
+    if (rows != NULL) {
+        masks = arena_alloc(arena, sizeof(uint64_t) * num_words);
+        rows->kernel(rows->data, num_words, rows->stride, letter, masks);
+    }
+    int kept = 0;
+    for (int i = 0; i < num_words; i++) {
+        uint64_t word_mask;
+        if (masks != NULL) {
+            word_mask = masks[i];
+        } else {
+            word_mask = word_letter_positions(word_list[i], letter);
+        }
+        if (word_mask == mask) {
+            char *word = word_list[i];
+            word_list[i] = word_list[kept];
+            word_list[kept] = word;
+            if (rows != NULL && i != kept) {
+                char row[64];
+                char *at_i = rows->data + (size_t) i * rows->stride;
+                char *at_kept = rows->data + (size_t) kept * rows->stride;
+                memcpy(row, at_i, rows->stride);
+                memcpy(at_i, at_kept, rows->stride);
+                memcpy(at_kept, row, rows->stride);
+            }
+            kept++;
+        }
+    }
+    fam->word_ptrs = word_list;
+    fam->num_words = kept;
+    fam->max_words = kept;
+    return fam;
+}
+
+
+/* Move the words of word_list whose positions of letter are exactly mask
+   to its front, and return them as a family, without partitioning the
+   other words. This is how a partition found in the cache narrows the
+   candidates: it is one pass with no hashing.
+*/
+Family *extract_family(char **word_list, int num_words, char letter, uint64_t mask) {
+    return extract(word_list, NULL, num_words, letter, mask);
+}
+
+
+/* Like extract_family, for words packed into rows as for partition_rows. */
+Family *extract_rows(char **word_list, Rows *rows, int num_words, char letter,
+                     uint64_t mask) {
+    return extract(word_list, rows, num_words, letter, mask);
+}
+
+
+/* Partition cache: the family the adversary kept for a guess made from
+   a game position. Every round starts from the same few positions, so
+   the popular openings, which split the most words, are looked up here
+   instead of partitioned again. Entries hold the chosen family's mask
+   and size rather than the partition's words, which are only pointers
+   into this run's dictionary; extract_family rebuilds the family from
+   the mask. The least recently used entry is evicted when it is full.
+*/
+
+/* Magic and version of a partition cache file. */
+#define CACHE_MAGIC "HANGPART"
+#define CACHE_VERSION 1
+
+/* A cached choice: the key, and the family kept for it. */
+struct cache_record {
+    Position pos;
+    char letter; /* The guess */
+    int num_words; /* Size of the chosen family */
+    uint64_t mask; /* Signature mask of the chosen family */
+};
+
+/* Header of a partition cache file, followed by num_records records,
+   least recently used first.
+*/
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t dictionary; /* get_dictionary_checksum of the words */
+    int32_t adversary; /* Depth of the adversary that chose */
+    uint32_t num_records;
+};
+
+struct cache_entry {
+    struct cache_record record;
+    struct cache_entry *bucket_next; /* Next entry in the same bucket */
+    struct cache_entry *newer; /* Towards the most recently used entry */
+    struct cache_entry *older;
+};
+
+static struct {
+    struct cache_entry *entries; /* All max_entries entries */
+    struct cache_entry *free_entries; /* Unused entries, chained by older */
+    struct cache_entry **buckets;
+    unsigned int num_buckets; /* Power of two */
+    struct cache_entry *newest;
+    struct cache_entry *oldest;
+    char *filename; /* File saved to on deallocation, or NULL */
+    uint64_t dictionary;
+    int adversary;
+    pthread_mutex_t lock;
+} cache;
+
+
+/* Fill in pos for words of length length, with the letters in guessed
+   already guessed and revealing pattern, and guesses_left guesses left.
+*/
+void init_position(Position *pos, int length, uint32_t guessed, int guesses_left,
+                   char *pattern) {
+    memset(pos, 0, sizeof(Position));
+    pos->length = length;
+    pos->guessed = guessed;
+    pos->guesses_left = guesses_left;
+    strncpy(pos->pattern, pattern, MAX_WORD_LENGTH);
+}
+
+
+/* Return the bucket of cache for pos and letter (64-bit FNV-1a). */
+static struct cache_entry **cache_bucket(Position *pos, char letter) {
+    const unsigned char *byte = (const unsigned char *) pos;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(Position); i++) {
+        hash = (hash ^ byte[i]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ (unsigned char) letter) * 0x100000001b3ULL;
+    return &cache.buckets[hash & (cache.num_buckets - 1)];
+}
+
+
+/* Unlink entry from the recency list of cache. */
+static void cache_unlink(struct cache_entry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache.newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache.oldest = entry->newer;
+    }
+}
+
+
+/* Make entry the most recently used entry of cache. */
+static void cache_push(struct cache_entry *entry) {
+    entry->newer = NULL;
+    entry->older = cache.newest;
+    if (cache.newest != NULL) {
+        cache.newest->newer = entry;
+    } else {
+        cache.oldest = entry;
+    }
+    cache.newest = entry;
+}
+
+
+/* Return the entry of cache for pos and letter, or NULL. */
+static struct cache_entry *cache_find(Position *pos, char letter) {
+    struct cache_entry *entry = *cache_bucket(pos, letter);
+    while (entry != NULL && (entry->record.letter != letter
+                             || memcmp(&entry->record.pos, pos, sizeof(Position)) != 0)) {
+        entry = entry->bucket_next;
+    }
+    return entry;
+}
+
+
+/* Enter record into cache as its most recently used entry, evicting the
+   least recently used entry if cache is full.
+*/
+static void cache_insert(struct cache_record *record) {
+    struct cache_entry *entry = cache_find(&record->pos, record->letter);
+    if (entry != NULL) {
+        cache_unlink(entry);
+    } else {
+        entry = cache.free_entries;
+        if (entry != NULL) {
+            cache.free_entries = entry->older;
+        } else {
+            entry = cache.oldest;
+            cache_unlink(entry);
+            struct cache_entry **link = cache_bucket(&entry->record.pos, entry->record.letter);
+            while (*link != entry) {
+                link = &(*link)->bucket_next;
+            }
+            *link = entry->bucket_next;
+        }
+        struct cache_entry **bucket = cache_bucket(&record->pos, record->letter);
+        entry->bucket_next = *bucket;
+        *bucket = entry;
+    }
+    /* The record is hashed, compared and saved byte for byte, so copy its
+       padding too, which struct assignment may leave out. */
+    memcpy(&entry->record, record, sizeof(struct cache_record));
+    cache_push(entry);
+}
+
+
+/* Read the entries saved in cache.filename, if it was saved for the
+   same dictionary and adversary. A missing or stale file is not an error.
+*/
+static void load_partition_cache(void) {
+    struct cache_header header;
+    struct cache_record record;
+    FILE *fp = fopen(cache.filename, "rb");
+    if (fp == NULL) {
+        return;
+    }
+    if (fread(&header, sizeof(header), 1, fp) == 1
+        && memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == CACHE_VERSION
+        && header.record_size == sizeof(struct cache_record)
+        && header.dictionary == cache.dictionary
+        && header.adversary == cache.adversary) {
+        for (uint32_t i = 0; i < header.num_records; i++) {
+            if (fread(&record, sizeof(record), 1, fp) != 1) {
+                break;
+            }
+            cache_insert(&record);
+        }
+    }
+    fclose(fp);
+}
+
+
+/* Write the entries of cache to cache.filename, oldest first, so that
+   loading them back keeps their order. They are written to a file of
+   this process's own and renamed over cache.filename, so processes
+   sharing the file, or a process killed while saving, never leave a
+   partial or interleaved file behind: the last complete save wins.
+*/
+static void save_partition_cache(void) {
+    struct cache_header header;
+    char tmpname[FILENAME_MAX];
+    int failed = 0;
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp.%ld", cache.filename, (long) getpid());
+    FILE *fp = fopen(tmpname, "wb");
+    if (fp == NULL) {
+        perror("fopen");
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.record_size = sizeof(struct cache_record);
+    header.dictionary = cache.dictionary;
+    header.adversary = cache.adversary;
+    for (struct cache_entry *entry = cache.oldest; entry != NULL; entry = entry->newer) {
+        header.num_records++;
+    }
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        perror("fwrite");
+        failed = 1;
+    }
+    for (struct cache_entry *entry = cache.oldest; entry != NULL && !failed; entry = entry->newer) {
+        if (fwrite(&entry->record, sizeof(struct cache_record), 1, fp) != 1) {
+            perror("fwrite");
+            failed = 1;
+        }
+    }
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        failed = 1;
+    }
+    /* Only a complete file replaces the old one. */
+    if (failed || rename(tmpname, cache.filename) == -1) {
+        if (!failed) {
+            perror("rename");
+        }
+        unlink(tmpname);
+    }
+}
+
+
+/* Set up the partition cache to hold max_entries choices, made on the
+   words with checksum dictionary by an adversary of depth adversary.
+   If filename is not NULL, the choices saved in it are loaded, and it
+   is rewritten by deallocate_partition_cache. This function should be
+   called at most once, on startup; without it nothing is cached.
+   max_entries must be at least 1.
+*/
+void init_partition_cache(int max_entries, char *filename, uint64_t dictionary, int adversary) {
+    if (max_entries < 1) {
+        fprintf(stderr, "init_partition_cache: cannot hold %d entries\n", max_entries);
+        exit(1);
+    }
+    cache.entries = malloc(sizeof(struct cache_entry) * max_entries);
+    cache.num_buckets = 1;
+    while (cache.num_buckets < (unsigned int) max_entries) {
+        cache.num_buckets *= 2;
+    }
+    cache.buckets = calloc(cache.num_buckets, sizeof(struct cache_entry *));
+    if (cache.entries == NULL || cache.buckets == NULL) {
+        perror("malloc error in init_partition_cache");
+        exit(1);
+    }
+    cache.free_entries = NULL;
+    for (int i = max_entries - 1; i >= 0; i--) {
+        cache.entries[i].older = cache.free_entries;
+        cache.free_entries = &cache.entries[i];
+    }
+    cache.newest = NULL;
+    cache.oldest = NULL;
+    cache.filename = filename;
+    cache.dictionary = dictionary;
+    cache.adversary = adversary;
+    pthread_mutex_init(&cache.lock, NULL);
+    if (filename != NULL) {
+        load_partition_cache();
+    }
+}
+
+
+/* Look up the family kept when letter was guessed from pos. If it is
+   cached, store its signature mask in mask and its size in num_words,
+   and return 1; otherwise return 0.
+*/
+int lookup_partition(Position *pos, char letter, uint64_t *mask, int *num_words) {
+    if (cache.entries == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache.lock);
+    struct cache_entry *entry = cache_find(pos, letter);
+    if (entry != NULL) {
+        cache_unlink(entry);
+        cache_push(entry);
+        *mask = entry->record.mask;
+        *num_words = entry->record.num_words;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return entry != NULL;
+}
+
+
+/* Remember that chosen was the family kept when its letter was guessed
+   from pos.
+*/
+void store_partition(Position *pos, char letter, Family *chosen) {
+    if (cache.entries == NULL) {
+        return;
+    }
+    struct cache_record record;
+    memset(&record, 0, sizeof(record));
+    memcpy(&record.pos, pos, sizeof(Position));
+    record.letter = letter;
+    record.num_words = chosen->num_words;
+    record.mask = chosen->mask;
+    pthread_mutex_lock(&cache.lock);
+    cache_insert(&record);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+/* Save the partition cache to its file, if it has one, and deallocate it. */
+void deallocate_partition_cache(void) {
+    if (cache.entries == NULL) {
+        return;
+    }
+    if (cache.filename != NULL) {
+        save_partition_cache();
+    }
+    pthread_mutex_destroy(&cache.lock);
+    free(cache.entries);
+    free(cache.buckets);
+    cache.entries = NULL;
+}
@@ -1,15 +1,58 @@
 #ifndef FAMILY_H
 #define FAMILY_H
 
+#include <stdint.h>
+#include "reading.h"
+#include "rows.h"
+
+struct fam_arena;
+struct pool;
+
+/* Below this many words, the parallel partitions run on the calling
+   thread alone; handing out the chunks would cost more.
+*/
+#define PARALLEL_MIN_WORDS 65536
+
 struct fam {
-    char *signature; /* Family signature; e.g. ---e */
+    uint64_t mask; /* Positions of letter in the signature; bit i is index i */
+    int length; /* Length of the signature */
+    char letter; /* Letter used to partition the words */
+    char *signature; /* Family signature; e.g. ---e, built on first use */
     char **word_ptrs; /* Words belonging to family */
     int num_words; /* Number of words in family */
     int max_words; /* Number of total pointers in word_ptrs so far */
     struct fam *next; /* NULL means end of list */
+    struct fam *bucket_next; /* Next family in the same index bucket */
+    struct fam_arena *arena; /* Arena holding this family and its words */
 };
 typedef struct fam Family; 
 
+/* Family sizes that guessing letter would split a word list into,
+   as made by generate_histograms.
+*/
+struct hist {
+    char letter;
+    int num_families; /* 0 if letter was skipped */
+    uint64_t *masks; /* Signature mask of each family; 0 is "no letter" */
+    int *counts; /* Number of words in each family */
+    int biggest; /* Index in masks and counts of the biggest family */
+    struct fam_arena *arena; /* Arena holding masks and counts */
+};
+typedef struct hist Histogram;
+
+/* A game position as the player sees it. It pins down the words that
+   are still candidates, so a guess made from it always splits them the
+   same way. Make one with init_position, which zeroes the padding too,
+   since positions are compared and hashed as raw bytes.
+*/
+struct position {
+    int length; /* Word length */
+    uint32_t guessed; /* Letters guessed before this guess; bit i is 'a' + i */
+    int guesses_left; /* Guesses left, or 0 if the adversary ignores them */
+    char pattern[MAX_WORD_LENGTH + 1]; /* Word as revealed so far; e.g. --e- */
+};
+typedef struct position Position;
+
 
 void init_family(int size);
 void print_families(Family* fam_list);
@@ -19,8 +62,27 @@ Family *find_family(Family *fam_list, char *sig);
 Family *find_biggest_family(Family *fam_list);
 void deallocate_families(Family *fam_list);
 Family *generate_families(char **word_list, char letter);
+Family *generate_families_parallel(char **word_list, char letter, struct pool *pool);
+Family *partition_families(char **word_list, int num_words, char letter);
+Family *partition_copy(char **word_list, int num_words, char letter);
+Family *partition_rows(char **word_list, Rows *rows, int num_words, char letter);
+Family *partition_rows_parallel(char **word_list, Rows *rows, int num_words, char letter,
+                                struct pool *pool);
 char *get_family_signature(Family *fam);
+uint64_t get_family_mask(Family *fam);
 char **get_new_word_list(Family *fam);
 char *get_random_word_from_family(Family *fam);
+Histogram *generate_histograms(char **word_list, int num_words, uint32_t skip);
+void deallocate_histograms(Histogram *hists);
+Family *extract_family(char **word_list, int num_words, char letter, uint64_t mask);
+Family *extract_rows(char **word_list, Rows *rows, int num_words, char letter,
+                     uint64_t mask);
+
+void init_position(Position *pos, int length, uint32_t guessed, int guesses_left,
+                   char *pattern);
+void init_partition_cache(int max_entries, char *filename, uint64_t dictionary, int adversary);
+int lookup_partition(Position *pos, char letter, uint64_t *mask, int *num_words);
+void store_partition(Position *pos, char letter, Family *chosen);
+void deallocate_partition_cache(void);
 
 #endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "book.h"
+#include "reading.h"
+#include "util.h"
+
+/* Build the opening book described in book.h for a dictionary:
+       mkbook <dictionary> <opening.book>
+   Each entry is found the way wheel plays with the greedy adversary,
+   starting from the words in dictionary order, so a game that takes its
+   first moves from the book keeps the same families it would have kept.
+*/
+
+/* Split the num_words words of words by letter, fill entry with the
+   biggest family, and return that family. The families must be
+   deallocated by the caller.
+*/
+static Family *book_move(char **words, int num_words, char letter,
+                         struct book_entry *entry, Family **fam_list) {
+    *fam_list = partition_families(words, num_words, letter);
+    Family *kept = find_biggest_family(*fam_list);
+    entry->mask = get_family_mask(kept);
+    entry->num_words = kept->num_words;
+    entry->num_families = 0;
+    for (Family *fam = *fam_list; fam != NULL; fam = fam->next) {
+        entry->num_families++;
+    }
+    return kept;
+}
+
+
+/* Fill block with the book entries for the num_words words of words,
+   which all have the same length.
+*/
+static void build_block(char **words, int num_words, struct book_entry *block) {
+    char **first_words = malloc(sizeof(char *) * num_words);
+    char **second_words = malloc(sizeof(char *) * num_words);
+    if (first_words == NULL || second_words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int first = 0; first < 26; first++) {
+        Family *first_list, *second_list;
+        memcpy(first_words, words, sizeof(char *) * num_words);
+        Family *kept = book_move(first_words, num_words, 'a' + first,
+                                 &block[first * 27], &first_list);
+        for (int second = 0; second < 26; second++) {
+            if (second == first) {
+                continue;
+            }
+            memcpy(second_words, kept->word_ptrs, sizeof(char *) * kept->num_words);
+            book_move(second_words, kept->num_words, 'a' + second,
+                      &block[first * 27 + 1 + second], &second_list);
+            deallocate_families(second_list);
+        }
+        deallocate_families(first_list);
+    }
+    free(first_words);
+    free(second_words);
+}
+
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <dictionary> <opening.book>\n", argv[0]);
+        exit(1);
+    }
+    Dictionary *dict = read_dictionary(argv[1]);
+    init_family(1024);
+
+    struct book_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+    header.version = BOOK_VERSION;
+    header.dictionary = get_dictionary_checksum(dict);
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        header.block[len] = dict->bucket_size[len] > 0 ? header.num_blocks++ : BOOK_NONE;
+    }
+
+    struct book_entry *entries = calloc((size_t) header.num_blocks * BOOK_BLOCK,
+                                        sizeof(struct book_entry));
+    if (entries == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        if (header.block[len] != BOOK_NONE) {
+            int count;
+            char **words = get_words_of_length(dict, len, &count);
+            build_block(words, count, &entries[(size_t) header.block[len] * BOOK_BLOCK]);
+        }
+    }
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+    size_t entries_size = (size_t) header.num_blocks * BOOK_BLOCK * sizeof(struct book_entry);
+    write_or_die(&header, sizeof(header), fp);
+    write_or_die(entries, entries_size, fp);
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        exit(1);
+    }
+
+    printf("%s: %u word lengths, %lu bytes\n", argv[2], header.num_blocks,
+           (unsigned long) (sizeof(header) + entries_size));
+    free(entries);
+    deallocate_dictionary(dict);
+    return 0;
+}
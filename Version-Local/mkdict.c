@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reading.h"
+#include "util.h"
+
+/* Compile a plain text dictionary into the binary format described in
+   dictfile.h, so that the games can map it instead of parsing text:
+       mkdict <dictionary.txt> <dictionary.bin>
+   The games do not checksum a compiled dictionary when they open it, so
+   that they start without reading it; check one in full with
+       mkdict -c <dictionary.bin>
+*/
+
+#define USAGE "Usage: %s <dictionary.txt> <dictionary.bin>\n" \
+              "       %s -c <dictionary.bin>\n"
+
+/* Check the checksums of the compiled dictionary filename, and return
+   the exit status: 0 if it is intact, 1 if not.
+*/
+static int check_dictionary(char *filename) {
+    struct dict_file df;
+    if (open_dict_file(filename, &df) == -1) {
+        fprintf(stderr, "%s: not a compiled dictionary\n", filename);
+        return 1;
+    }
+    int status = 0;
+    if (verify_dict_file(&df) == -1) {
+        fprintf(stderr, "%s: compiled dictionary is corrupt (bad checksum)\n", filename);
+        status = 1;
+    } else {
+        printf("%s: %u words, checksums ok\n", filename, df.header->num_words);
+    }
+    close_dict_file(&df);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+        return check_dictionary(argv[2]);
+    }
+    if (argc != 3) {
+        fprintf(stderr, USAGE, argv[0], argv[0]);
+        exit(1);
+    }
+    Dictionary *dict = read_dictionary(argv[1]);
+
+    struct dict_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DICT_MAGIC, sizeof(header.magic));
+    header.version = DICT_VERSION;
+    header.num_words = dict->num_words;
+    header.blob_size = dict->arena_size;
+
+    /* The offset table drops the NULL that ends each bucket. */
+    size_t offsets_size = dict_offsets_size(dict->num_words);
+    size_t payload_size = offsets_size + dict->arena_size;
+    char *payload = calloc(1, payload_size + 1);
+    if (payload == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    uint32_t *offsets = (uint32_t *) payload;
+    uint32_t next = 0;
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        header.bucket_start[len] = next;
+        header.bucket_size[len] = dict->bucket_size[len];
+        for (char **p = &dict->words[dict->bucket_start[len]]; *p; p++) {
+            offsets[next++] = *p - dict->arena;
+        }
+    }
+    memcpy(payload + offsets_size, dict->arena, dict->arena_size);
+    header.checksum = dict_checksum(payload, payload_size);
+    header.words_checksum = dict_checksum(payload + offsets_size, dict->arena_size);
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+    write_or_die(&header, sizeof(header), fp);
+    write_or_die(payload, payload_size, fp);
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        exit(1);
+    }
+
+    printf("%s: %d words, %lu bytes\n", argv[2], dict->num_words,
+           (unsigned long) (sizeof(header) + payload_size));
+    free(payload);
+    deallocate_dictionary(dict);
+    return 0;
+}
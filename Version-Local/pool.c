@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+#include "trace.h"
+
+/* A fixed set of worker threads that run batches of tasks.
+   The thread calling pool_run works on the batch too, so a pool of
+   num_threads threads starts num_threads - 1 workers.
+*/
+struct pool {
+    pthread_t *workers;
+    int num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready; /* Signalled when a batch starts */
+    pthread_cond_t work_done; /* Signalled when a batch finishes */
+    pool_task task; /* The batch being run */
+    void *context;
+    void *trace_owner; /* Guess the batch counts allocations toward, for TRACE */
+    int num_tasks;
+    int next_task; /* Index of the next task to hand out */
+    int tasks_done;
+    unsigned long batch; /* Number of batches started so far */
+    int shutting_down;
+};
+
+
+/* Run tasks of the current batch of pool until none are left. */
+static void run_tasks(struct pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->next_task < pool->num_tasks) {
+        int task = pool->next_task++;
+        pool_task fn = pool->task;
+        void *context = pool->context;
+        void *owner = pool->trace_owner;
+        pthread_mutex_unlock(&pool->lock);
+        TRACE_ADOPT(owner);
+        fn(context, task);
+        TRACE_ADOPT(NULL);
+        pthread_mutex_lock(&pool->lock);
+        pool->tasks_done++;
+        if (pool->tasks_done == pool->num_tasks) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/* Body of a worker thread: run every batch until the pool shuts down. */
+static void *worker_main(void *arg) {
+    struct pool *pool = arg;
+    unsigned long seen = 0;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->batch == seen && !pool->shutting_down) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutting_down) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+        run_tasks(pool);
+    }
+}
+
+
+/* Return a new pool that runs tasks on num_threads threads,
+   counting the one that calls pool_run.
+*/
+struct pool *create_pool(int num_threads) {
+    struct pool *pool = malloc(sizeof(struct pool));
+    if (pool == NULL) {
+        perror("malloc error in create_pool");
+        exit(1);
+    }
+    pool->num_workers = num_threads > 1 ? num_threads - 1 : 0;
+    pool->workers = malloc(sizeof(pthread_t) * (pool->num_workers + 1));
+    if (pool->workers == NULL) {
+        perror("malloc error in create_pool");
+        exit(1);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->num_tasks = 0;
+    pool->next_task = 0;
+    pool->tasks_done = 0;
+    pool->batch = 0;
+    pool->shutting_down = 0;
+    for (int i = 0; i < pool->num_workers; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+
+/* Return the number of threads pool runs tasks on. */
+int get_pool_size(struct pool *pool) {
+    return pool->num_workers + 1;
+}
+
+
+/* Call task(context, i) for every i from 0 to num_tasks - 1, spread
+   over the threads of pool, and return once all of them have finished.
+*/
+void pool_run(struct pool *pool, pool_task task, void *context, int num_tasks) {
+    if (num_tasks <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->trace_owner = TRACE_OWNER();
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->tasks_done = 0;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->tasks_done < pool->num_tasks) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/* Stop the workers of pool and deallocate it. */
+void destroy_pool(struct pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->workers);
+    free(pool);
+}
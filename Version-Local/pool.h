@@ -0,0 +1,14 @@
+#ifndef POOL_H
+#define POOL_H
+
+/* Work function run by pool_run: called once for every task index. */
+typedef void (*pool_task)(void *context, int task);
+
+struct pool;
+
+struct pool *create_pool(int num_threads);
+int get_pool_size(struct pool *pool);
+void pool_run(struct pool *pool, pool_task task, void *context, int num_tasks);
+void destroy_pool(struct pool *pool);
+
+#endif
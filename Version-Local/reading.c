@@ -2,54 +2,305 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* Read all words from filename and return them in a 2D array. */
-char **read_words(char *filename) {
-    char buffer[MAX_WORD_LENGTH + 1];
-    FILE *fp;
-    int word_count;
-    char **words;
+#if MAX_WORD_LENGTH != DICT_MAX_LENGTH
+#error "MAX_WORD_LENGTH must match the compiled dictionary's DICT_MAX_LENGTH"
+#endif
 
-    fp = fopen(filename, "r");
-    if (!fp) {
-        perror("fopen");
+/* Round n up to a multiple of 8, so every word in the arena starts
+   its masks on an aligned address.
+*/
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+/* Return the mask of letters present in the length characters at word. */
+static uint32_t letters_of(const char *word, int length) {
+    uint32_t present = 0;
+    for (int i = 0; i < length; i++) {
+        unsigned int bit = word[i] - 'a';
+        if (bit < 26) {
+            present |= 1u << bit;
+        }
+    }
+    return present;
+}
+
+/* Return the number of arena bytes taken by a word of length length
+   with the letters in present: its masks, its index and its characters.
+*/
+static size_t indexed_word_size(uint32_t present, int length) {
+    return __builtin_popcount(present) * sizeof(uint64_t)
+           + sizeof(struct word_index) + ALIGN8(length + 1);
+}
+
+/* Copy the length characters at word into the arena at dest, with its
+   letter index (see struct word_index) in front of it. Return a pointer
+   to the null-terminated copy, whose padding is zeroed as well, so the
+   arena and its checksum depend only on the words.
+*/
+static char *store_indexed_word(char *dest, const char *word, int length) {
+    uint64_t positions[26] = {0};
+    uint32_t present = 0;
+    for (int i = 0; i < length; i++) {
+        unsigned int bit = word[i] - 'a';
+        if (bit < 26) {
+            present |= 1u << bit;
+            positions[bit] |= (uint64_t) 1 << i;
+        }
+    }
+    /* Masks are stored in alphabetical order, ending right at the header. */
+    uint64_t *mask = (uint64_t *) dest;
+    for (int bit = 0; bit < 26; bit++) {
+        if (present & (1u << bit)) {
+            *mask++ = positions[bit];
+        }
+    }
+    struct word_index *index = (struct word_index *) mask;
+    index->present = present;
+    index->length = length;
+    char *copy = (char *) (index + 1);
+    memcpy(copy, word, length);
+    memset(copy + length, 0, ALIGN8(length + 1) - length);
+    return copy;
+}
+
+/* Return the length of the line starting at line, which ends at the
+   next newline or at end. Store the start of the following line in next.
+*/
+static int line_length(const char *line, const char *end, const char **next) {
+    const char *newline = memchr(line, '\n', end - line);
+    if (newline == NULL) {
+        *next = end;
+        return end - line;
+    }
+    *next = newline + 1;
+    return newline - line;
+}
+
+/* Bytes read_stream reads into at first; its buffer doubles as it fills. */
+#define STREAM_BUFFER_SIZE 65536
+
+/* Read fd, which cannot be mapped (a pipe, say), to its end into a buffer
+   that doubles in size whenever it fills, so a stream of any length costs
+   a logarithmic number of reallocations. Store the number of bytes read
+   in size, and return the buffer, which the caller must free.
+*/
+static char *read_stream(int fd, size_t *size) {
+    size_t capacity = STREAM_BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        perror("malloc");
         exit(1);
     }
+    *size = 0;
+    while (1) {
+        if (*size == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if (buffer == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        ssize_t got = read(fd, buffer + *size, capacity - *size);
+        if (got == -1) {
+            perror("read");
+            exit(1);
+        }
+        if (got == 0) {
+            return buffer;
+        }
+        *size += got;
+    }
+}
 
-    word_count = 0;
-    words = malloc(MAX_WORDS * sizeof(*words));
-    if (words == NULL) {
+/* Read all words from the text dictionary filename into dict, bucketed
+   by length.
+
+   A regular file is mapped into memory, and anything else, such as a
+   pipe, is streamed into a buffer by read_stream. The text is then read
+   in two passes: the first sizes every bucket and the arena, the second
+   copies each word with its letter index into one arena allocation,
+   grouped by length. So loading costs two allocations however many words
+   there are, and freeing costs two frees. Lines longer than
+   MAX_WORD_LENGTH are skipped, and how many were is reported.
+*/
+static void read_text_dictionary(Dictionary *dict, char *filename) {
+    size_t arena_size[MAX_WORD_LENGTH + 1] = {0};
+    const char *text = NULL, *end, *line, *next;
+    char *buffer = NULL;
+    size_t text_size = 0;
+    struct stat st;
+    int fd, length;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        exit(1);
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(1);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        buffer = read_stream(fd, &text_size);
+        text = buffer;
+    } else if (st.st_size > 0) {
+        text_size = st.st_size;
+        text = mmap(NULL, text_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        madvise((void *) text, text_size, MADV_SEQUENTIAL);
+    }
+    end = text + text_size;
+
+    memset(dict->bucket_size, 0, sizeof(dict->bucket_size));
+    dict->num_words = 0;
+
+    /* First pass: size the buckets and their share of the arena. */
+    int line_number = 0, num_skipped = 0, first_skipped = 0;
+    for (line = text; line < end; line = next) {
+        length = line_length(line, end, &next);
+        line_number++;
+        if (length <= MAX_WORD_LENGTH) {
+            dict->bucket_size[length]++;
+            arena_size[length] += indexed_word_size(letters_of(line, length), length);
+            dict->num_words++;
+        } else if (num_skipped++ == 0) {
+            first_skipped = line_number;
+        }
+    }
+    if (num_skipped > 0) {
+        fprintf(stderr, "%s: skipped %d words longer than %d characters (first on line %d)\n",
+                filename, num_skipped, MAX_WORD_LENGTH, first_skipped);
+    }
+
+    /* One extra slot per bucket for its terminating NULL. */
+    size_t arena_next[MAX_WORD_LENGTH + 1];
+    size_t arena_total = 0;
+    int start = 0;
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        dict->bucket_start[len] = start;
+        start += dict->bucket_size[len] + 1;
+        arena_next[len] = arena_total;
+        arena_total += arena_size[len];
+    }
+    dict->words = malloc(start * sizeof(char *));
+    dict->arena = malloc(arena_total + 1);
+    dict->arena_size = arena_total;
+    if (dict->words == NULL || dict->arena == NULL) {
         perror("malloc");
         exit(1);
     }
 
-    /*Get and store all words*/
-    while (fgets(buffer, MAX_WORD_LENGTH, fp)) {
-        if (buffer[strlen(buffer) - 1] == '\n') {
-            buffer[strlen(buffer) - 1] = '\0'; /*Delete newline*/
+    /* Second pass: copy every word and its index into its bucket. */
+    int next_word[MAX_WORD_LENGTH + 1];
+    memcpy(next_word, dict->bucket_start, sizeof(next_word));
+    for (line = text; line < end; line = next) {
+        length = line_length(line, end, &next);
+        if (length <= MAX_WORD_LENGTH) {
+            char *word = store_indexed_word(dict->arena + arena_next[length], line, length);
+            arena_next[length] += indexed_word_size(word_letters(word), length);
+            dict->words[next_word[length]++] = word;
         }
-        words[word_count] = malloc(strlen(buffer) + 1);
-        if (words[word_count] == NULL) {
-            perror("malloc");
-            exit(1);
+    }
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        dict->words[next_word[len]] = NULL;
+    }
+
+    if (buffer != NULL) {
+        free(buffer);
+    } else if (text != NULL) {
+        munmap((void *) text, text_size);
+    }
+    close(fd);
+}
+
+/* Build the bucketed word list of dict over the compiled dictionary
+   mapped in dict->compiled. The words and their letter indexes are used
+   where they lie in the mapping; only the pointer array is allocated.
+*/
+static void read_compiled_dictionary(Dictionary *dict) {
+    struct dict_file *df = &dict->compiled;
+    const struct dict_header *header = df->header;
+
+    dict->num_words = header->num_words;
+    dict->arena = (char *) df->blob;
+    dict->arena_size = header->blob_size;
+    dict->words = malloc((header->num_words + MAX_WORD_LENGTH + 1) * sizeof(char *));
+    if (dict->words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    /* One extra slot per bucket for its terminating NULL. */
+    int start = 0;
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        dict->bucket_start[len] = start;
+        dict->bucket_size[len] = header->bucket_size[len];
+        for (uint32_t i = 0; i < header->bucket_size[len]; i++) {
+            dict->words[start + i] = (char *) dict_file_word(df, header->bucket_start[len] + i);
         }
+        start += dict->bucket_size[len];
+        dict->words[start++] = NULL;
+    }
+}
 
-        /* strcpy is safe because we just allocated exactly enough space. */
-        strcpy(words[word_count], buffer);
-        word_count++;
+/* Read all words from filename and bucket them by length, so that the
+   words of a given length can be found without scanning the dictionary.
+   filename may be a dictionary compiled by mkdict, which is mapped and
+   used in place, or a plain text dictionary with one word per line.
+*/
+Dictionary *read_dictionary(char *filename) {
+    Dictionary *dict = malloc(sizeof(Dictionary));
+    if (dict == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (open_dict_file(filename, &dict->compiled) == 0) {
+        read_compiled_dictionary(dict);
+    } else {
+        dict->compiled.header = NULL;
+        read_text_dictionary(dict, filename);
     }
-    words[word_count] = NULL;
+    return dict;
+}
 
-    fclose(fp);
-    return words;
+/* Return the NULL-terminated list of words of length len in dict, and
+   store their number in count. The list belongs to dict.
+*/
+char **get_words_of_length(Dictionary *dict, int len, int *count) {
+    if (len < 0 || len > MAX_WORD_LENGTH) {
+        *count = 0;
+        return NULL;
+    }
+    *count = dict->bucket_size[len];
+    return &dict->words[dict->bucket_start[len]];
+}
+
+/* Return a checksum of the words of dict and their letter indexes.
+   It is the same whether dict was read as text or compiled, so it
+   identifies the word list for anything saved about it across runs.
+   A compiled dictionary has it in its header, so its words are not read.
+*/
+uint64_t get_dictionary_checksum(Dictionary *dict) {
+    if (dict->compiled.header != NULL) {
+        return dict->compiled.header->words_checksum;
+    }
+    return dict_checksum(dict->arena, dict->arena_size);
 }
 
-/* Deallocate all memory acquired by read_words. */
-void deallocate_words(char **words) {
-    char **p = words;
-    while (*p) {
-        free(*p);
-        p++;
+/* Deallocate all memory acquired by read_dictionary. */
+void deallocate_dictionary(Dictionary *dict) {
+    if (dict->compiled.header != NULL) {
+        close_dict_file(&dict->compiled);
+    } else {
+        free(dict->arena);
     }
-    free(words);
+    free(dict->words);
+    free(dict);
 }
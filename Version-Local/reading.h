@@ -1,16 +1,78 @@
 #ifndef READING_H
 #define READING_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "dictfile.h"
+
 /* Maximum length of word to read. */
 #define MAX_WORD_LENGTH 40
 
-/* Maximum number of words in the dictionary. */
-#define MAX_WORDS 130000
-
 /* Dictionary file name */
 #define DICTIONARY "dictionary.txt"
 
-char **read_words(char *filename);
-void deallocate_words(char **words);
+/* Compiled dictionary file name, built from DICTIONARY by mkdict */
+#define COMPILED_DICTIONARY "dictionary.bin"
+
+/* Letter index stored in front of every word read by read_dictionary,
+   so that the positions of a letter in a word are a lookup instead of a
+   scan. The position masks of the letters present in the word sit just
+   before this header, one per present letter in alphabetical order, and
+   the characters of the word follow right after it.
+*/
+struct word_index {
+    uint32_t present; /* Bit i is set if 'a' + i occurs in the word */
+    uint32_t length; /* Number of characters in the word */
+};
+
+/* Return the index header of word, which must come from read_dictionary. */
+static inline struct word_index *get_word_index(const char *word) {
+    return (struct word_index *) word - 1;
+}
+
+/* Return the 26-bit mask of letters present in word. */
+static inline uint32_t word_letters(const char *word) {
+    return get_word_index(word)->present;
+}
+
+/* Return the length of word. */
+static inline int word_length(const char *word) {
+    return get_word_index(word)->length;
+}
+
+/* Return the position masks of the letters present in word, in
+   alphabetical order: one per set bit of word_letters(word).
+*/
+static inline const uint64_t *word_letter_masks(const char *word) {
+    struct word_index *index = get_word_index(word);
+    return (const uint64_t *) index - __builtin_popcount(index->present);
+}
+
+/* Return the mask of positions of letter in word; bit i is word[i]. */
+static inline uint64_t word_letter_positions(const char *word, char letter) {
+    struct word_index *index = get_word_index(word);
+    unsigned int bit = letter - 'a';
+    if (bit >= 26 || !(index->present & (1u << bit))) {
+        return 0;
+    }
+    int rank = __builtin_popcount(index->present >> bit);
+    return ((uint64_t *) index)[-rank];
+}
+
+/* All words of a dictionary, bucketed by length when it is loaded. */
+typedef struct dict {
+    char **words; /* Words grouped by length; each group ends with NULL */
+    int num_words; /* Number of words, not counting the NULLs */
+    int bucket_start[MAX_WORD_LENGTH + 1]; /* Index in words of each group */
+    int bucket_size[MAX_WORD_LENGTH + 1]; /* Number of words in each group */
+    char *arena; /* Every word and its letter index, grouped by length */
+    size_t arena_size; /* Number of bytes used in arena */
+    struct dict_file compiled; /* header is NULL unless read from mkdict output */
+} Dictionary;
+
+Dictionary *read_dictionary(char *filename);
+char **get_words_of_length(Dictionary *dict, int len, int *count);
+uint64_t get_dictionary_checksum(Dictionary *dict);
+void deallocate_dictionary(Dictionary *dict);
 
 #endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "round.h"
+#include "adversary.h"
+#include "trace.h"
+#include "rows.h"
+
+/* Start round as a game on the words of dict of length length, with
+   guesses wrong guesses allowed, taking the first moves from book if
+   it is not NULL, with the adversary searching in search. dict must have
+   words of that length.
+*/
+void start_round(Round *round, Dictionary *dict, int length, int guesses, Book *book,
+                 struct search_context *search) {
+    int num_words;
+    char **all_of_length = get_words_of_length(dict, length, &num_words);
+
+    /* Copied once per round, because every guess reorders it in place,
+       and the dictionary's bucket is shared by every round, including
+       the rounds simulate plays at the same time on other threads.
+       The rows are packed from this copy once, too. */
+    round->word_list = malloc(sizeof(char *) * num_words);
+    TRACE_ALLOC();
+    if (round->word_list == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(round->word_list, all_of_length, sizeof(char *) * num_words);
+    /* The kernel for this length is looked up once, here. */
+    round->rows.data = new_rows(round->word_list, num_words, length);
+    round->rows.stride = row_stride(length);
+    round->rows.kernel = get_length_kernel(length);
+    round->candidates = round->word_list;
+    round->num_candidates = num_words;
+    round->length = length;
+    round->guesses = guesses;
+    round->guessed = 0;
+    memset(round->pattern, '-', length);
+    round->pattern[length] = '\0';
+    round->famlist = NULL;
+    round->kept = NULL;
+    round->book = book;
+    round->search = search;
+}
+
+
+/* Split the candidates of round by guess, made from pos, and return the
+   family the adversary keeps. Store the list of families, to be
+   deallocated, in famlist.
+   An opening move found in the book, or a guess made from a position
+   seen before and so in the partition cache, is answered without
+   partitioning; only the kept family is then pulled out of candidates.
+*/
+static Family *keep_family(Round *round, Position *pos, char guess, Family **famlist) {
+    char **candidates = round->candidates;
+    int num_candidates = round->num_candidates;
+    Rows rows = round->rows;
+    rows.data += (size_t) (candidates - round->word_list) * rows.stride;
+    uint64_t mask;
+    int num_words;
+    int found = lookup_book(round->book, pos, guess, &mask, &num_words)
+                || lookup_partition(pos, guess, &mask, &num_words);
+    TRACE_PHASE(PHASE_LOOKUP);
+    if (found) {
+        *famlist = extract_rows(candidates, &rows, num_candidates, guess, mask);
+        if ((*famlist)->num_words == num_words) {
+            TRACE_PHASE(PHASE_EXTRACT);
+            return *famlist;
+        }
+        /* Stale entry; partition after all. Undoing the extract is part
+           of it, so the deallocate phase stays one span of the guess. */
+        deallocate_families(*famlist);
+        TRACE_PHASE(PHASE_EXTRACT);
+    }
+    *famlist = partition_rows_parallel(candidates, &rows, num_candidates, guess,
+                                       get_search_pool(round->search));
+    TRACE_PHASE(PHASE_PARTITION);
+    Family *kept = choose_family(round->search, *famlist,
+                                 pos->guessed | 1u << (guess - 'a'), round->guesses);
+    TRACE_PHASE(PHASE_CHOOSE);
+    store_partition(pos, guess, kept);
+    TRACE_PHASE(PHASE_STORE);
+    return kept;
+}
+
+
+/* Play the lowercase letter guess, which has not been guessed yet, in
+   round: let the adversary keep a family, reveal its positions in the
+   pattern, and narrow the candidates to it. A wrong guess costs a guess.
+   Return 1 if guess is in the word, 0 if not.
+*/
+int play_guess(Round *round, char guess) {
+    Position pos;
+
+    TRACE_BEGIN_GUESS();
+    /* Only a lookahead adversary's choice depends on the guesses left. */
+    init_position(&pos, round->length, round->guessed,
+                  get_adversary_depth() > 1 ? round->guesses : 0, round->pattern);
+    round->guessed |= 1u << (guess - 'a');
+    deallocate_families(round->famlist);
+    TRACE_PHASE(PHASE_DEALLOCATE);
+    round->kept = keep_family(round, &pos, guess, &round->famlist);
+
+    /* Reveal the positions set in the signature mask. */
+    uint64_t sig = get_family_mask(round->kept);
+    for (int i = 0; i < round->length; i++) {
+        if (sig & ((uint64_t) 1 << i)) {
+            round->pattern[i] = guess;
+        }
+    }
+    if (sig == 0) {
+        round->guesses--;
+    }
+
+#ifdef TRACE
+    int num_families = 0;
+    for (Family *fam = round->famlist; fam != NULL; fam = fam->next) {
+        num_families++;
+    }
+    TRACE_END_GUESS(guess, round->num_candidates, num_families, round->kept->num_words);
+#endif
+
+    /* The kept family is already a range of the candidates. */
+    round->candidates = round->kept->word_ptrs;
+    round->num_candidates = round->kept->num_words;
+    return sig != 0;
+}
+
+
+/* Return 1 if the player has revealed the whole word of round. */
+int round_won(Round *round) {
+    return strchr(round->pattern, '-') == NULL;
+}
+
+
+/* Return 1 if the player has run out of guesses in round. */
+int round_lost(Round *round) {
+    return round->guesses <= 0;
+}
+
+
+/* Deallocate the words and families of round. */
+void end_round(Round *round) {
+    TRACE_END_ROUND(round->length, round_won(round));
+    deallocate_families(round->famlist);
+    free(round->word_list);
+    free(round->rows.data);
+    round->famlist = NULL;
+    round->word_list = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef ROUND_H
+#define ROUND_H
+
+#include <stdint.h>
+#include "family.h"
+#include "reading.h"
+#include "book.h"
+#include "adversary.h"
+
+/* The adversary's side of one game: the words it can still pick from and
+   what the player has been shown. wheel drives it from the keyboard, and
+   the simulator from scripted guessers.
+*/
+struct round {
+    int length; /* Word length */
+    int guesses; /* Wrong guesses the player has left */
+    uint32_t guessed; /* Letters guessed so far; bit i is 'a' + i */
+    char pattern[MAX_WORD_LENGTH + 1]; /* Word as revealed so far; e.g. --e- */
+    char **word_list; /* This round's copy of the length-length words */
+    char **candidates; /* Words still possible, a range of word_list */
+    int num_candidates;
+    Rows rows; /* word_list packed by new_rows, in the same order, and the
+                  kernel for length */
+    Family *famlist; /* Families the latest guess split the words into */
+    Family *kept; /* The family of famlist the adversary kept */
+    Book *book; /* Opening book, or NULL */
+    struct search_context *search; /* Where the adversary searches */
+};
+typedef struct round Round;
+
+void start_round(Round *round, Dictionary *dict, int length, int guesses, Book *book,
+                 struct search_context *search);
+int play_guess(Round *round, char guess);
+int round_won(Round *round);
+int round_lost(Round *round);
+void end_round(Round *round);
+
+#endif
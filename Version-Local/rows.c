@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rows.h"
+#include "reading.h"
+#include "trace.h"
+
+/* The widest SIMD kernels compare the first 48 bytes of a row. */
+#if MAX_WORD_LENGTH > 48
+#error "rows.c compares at most 48 bytes of a row"
+#endif
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#define ROW_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Return the number of bytes of a row for words of length length:
+   the smallest of 16, 32 and 64 that holds them.
+*/
+int row_stride(int length) {
+    if (length <= 16) {
+        return 16;
+    }
+    return length <= 32 ? 32 : 64;
+}
+
+
+/* Return a new row buffer holding the num_words words of words, which
+   all have length length, in order. Free it with free.
+*/
+char *new_rows(char **words, int num_words, int length) {
+    int stride = row_stride(length);
+    char *rows;
+    int failed = posix_memalign((void **) &rows, ROW_ALIGN, (size_t) num_words * stride + 1);
+    TRACE_ALLOC();
+    if (failed != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+    memset(rows, 0, (size_t) num_words * stride);
+    for (int i = 0; i < num_words; i++) {
+        memcpy(rows + (size_t) i * stride, words[i], length);
+    }
+    return rows;
+}
+
+
+/* Row kernel for any machine and length: compare one byte at a time,
+   up to the end of the word.
+*/
+static void generic_masks(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    for (int i = 0; i < num_rows; i++) {
+        const char *row = rows + (size_t) i * stride;
+        uint64_t mask = 0;
+        for (int j = 0; j < stride && row[j] != '\0'; j++) {
+            if (row[j] == letter) {
+                mask |= (uint64_t) 1 << j;
+            }
+        }
+        masks[i] = mask;
+    }
+}
+
+
+#ifdef ROW_SIMD
+
+/* SSE2 row kernels for each stride, unrolled: 16 bytes per compare.
+   Words of up to 8 letters only reach into the first half of their
+   16-byte rows, so sse2_masks_8 compares the first halves of two rows
+   at once.
+*/
+static void sse2_masks_16(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m128i key = _mm_set1_epi8(letter);
+    for (int i = 0; i < num_rows; i++) {
+        const __m128i *row = (const __m128i *) (rows + (size_t) i * 16);
+        masks[i] = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(row), key));
+    }
+}
+
+static void sse2_masks_8(const char *rows, int num_rows, int stride, char letter,
+                         uint64_t *masks) {
+    __m128i key = _mm_set1_epi8(letter);
+    int i = 0;
+    for (; i + 1 < num_rows; i += 2) {
+        const __m128i *row = (const __m128i *) (rows + (size_t) i * 16);
+        __m128i halves = _mm_unpacklo_epi64(_mm_load_si128(row), _mm_load_si128(row + 1));
+        uint32_t found = _mm_movemask_epi8(_mm_cmpeq_epi8(halves, key));
+        masks[i] = found & 0xff;
+        masks[i + 1] = found >> 8;
+    }
+    if (i < num_rows) {
+        sse2_masks_16(rows + (size_t) i * 16, 1, 16, letter, masks + i);
+    }
+}
+
+static void sse2_masks_32(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m128i key = _mm_set1_epi8(letter);
+    for (int i = 0; i < num_rows; i++) {
+        const __m128i *row = (const __m128i *) (rows + (size_t) i * 32);
+        uint64_t low = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(row), key));
+        uint64_t high = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(row + 1), key));
+        masks[i] = low | high << 16;
+    }
+}
+
+/* For words of 33 to 40 letters: the last 16 bytes of their 64-byte
+   rows are always padding, so only three vectors are compared.
+*/
+static void sse2_masks_48(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m128i key = _mm_set1_epi8(letter);
+    for (int i = 0; i < num_rows; i++) {
+        const __m128i *row = (const __m128i *) (rows + (size_t) i * 64);
+        uint64_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(row), key));
+        mask |= (uint64_t) (uint32_t) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128(row + 1), key)) << 16;
+        mask |= (uint64_t) (uint32_t) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128(row + 2), key)) << 32;
+        masks[i] = mask;
+    }
+}
+
+
+/* AVX2 row kernels for each stride, unrolled: 32 bytes per compare,
+   which is two rows at once for words of up to 16 letters, and the
+   first halves of four rows for words of up to 8. A range of rows may
+   start at an odd row, so the loads are unaligned.
+*/
+__attribute__((target("avx2")))
+static void avx2_masks_16(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m256i key = _mm256_set1_epi8(letter);
+    int i = 0;
+    for (; i + 1 < num_rows; i += 2) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (rows + (size_t) i * 16));
+        uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, key));
+        masks[i] = found & 0xffff;
+        masks[i + 1] = found >> 16;
+    }
+    if (i < num_rows) {
+        sse2_masks_16(rows + (size_t) i * 16, 1, 16, letter, masks + i);
+    }
+}
+
+/* The first halves of rows i to i + 3 are unpacked into the lanes as
+   rows i and i + 2, then i + 1 and i + 3, so the bytes of found are the
+   masks of the four rows in that order.
+*/
+__attribute__((target("avx2")))
+static void avx2_masks_8(const char *rows, int num_rows, int stride, char letter,
+                         uint64_t *masks) {
+    __m256i key = _mm256_set1_epi8(letter);
+    int i = 0;
+    for (; i + 3 < num_rows; i += 4) {
+        const __m256i *row = (const __m256i *) (rows + (size_t) i * 16);
+        __m256i halves = _mm256_unpacklo_epi64(_mm256_loadu_si256(row),
+                                               _mm256_loadu_si256(row + 1));
+        uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(halves, key));
+        masks[i] = found & 0xff;
+        masks[i + 2] = (found >> 8) & 0xff;
+        masks[i + 1] = (found >> 16) & 0xff;
+        masks[i + 3] = found >> 24;
+    }
+    if (i < num_rows) {
+        sse2_masks_8(rows + (size_t) i * 16, num_rows - i, 16, letter, masks + i);
+    }
+}
+
+__attribute__((target("avx2")))
+static void avx2_masks_32(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m256i key = _mm256_set1_epi8(letter);
+    for (int i = 0; i < num_rows; i++) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (rows + (size_t) i * 32));
+        masks[i] = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, key));
+    }
+}
+
+/* For words of 33 to 40 letters: one 32-byte compare and one 16-byte
+   compare, skipping the padding at the end of their rows.
+*/
+__attribute__((target("avx2")))
+static void avx2_masks_48(const char *rows, int num_rows, int stride, char letter,
+                          uint64_t *masks) {
+    __m256i key = _mm256_set1_epi8(letter);
+    for (int i = 0; i < num_rows; i++) {
+        const char *row = rows + (size_t) i * 64;
+        uint64_t low = (uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) row), key));
+        uint64_t high = (uint32_t) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128((const __m128i *) (row + 32)),
+                           _mm256_castsi256_si128(key)));
+        masks[i] = low | high << 32;
+    }
+}
+
+#endif
+
+
+/* The kinds of row kernel, in the order of row_kernel_names. */
+enum kernel_kind { KERNEL_GENERIC, KERNEL_SSE2, KERNEL_AVX2 };
+
+const char *const row_kernel_names[NUM_ROW_KERNELS] = {"generic", "sse2", "avx2"};
+
+/* Kind of kernel get_length_kernel hands out. */
+static enum kernel_kind current_kind;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+
+/* Return 1 if this processor can run kernels of kind, or 0. */
+static int kind_supported(enum kernel_kind kind) {
+#ifdef ROW_SIMD
+    __builtin_cpu_init();
+    return kind != KERNEL_AVX2 || __builtin_cpu_supports("avx2");
+#else
+    return kind < KERNEL_SSE2;
+#endif
+}
+
+
+/* Pick the best kind of kernel this processor runs. */
+static void choose_kind(void) {
+    current_kind = NUM_ROW_KERNELS - 1;
+    while (!kind_supported(current_kind)) {
+        current_kind--;
+    }
+}
+
+
+/* Return the row kernel for words of length length, of the best kind
+   this processor runs. The SIMD kernels compare only the 8 or 16-byte
+   pieces of a row that length reaches into. A round looks its kernel up
+   once, when it starts.
+*/
+row_kernel get_length_kernel(int length) {
+    pthread_once(&kernel_once, choose_kind);
+    switch (current_kind) {
+#ifdef ROW_SIMD
+    case KERNEL_AVX2:
+        return length <= 8 ? avx2_masks_8 : length <= 16 ? avx2_masks_16
+               : length <= 32 ? avx2_masks_32 : avx2_masks_48;
+    case KERNEL_SSE2:
+        return length <= 8 ? sse2_masks_8 : length <= 16 ? sse2_masks_16
+               : length <= 32 ? sse2_masks_32 : sse2_masks_48;
+#endif
+    default:
+        return generic_masks;
+    }
+}
+
+
+/* Store in masks[i] the mask of positions of letter in row i of the
+   num_rows rows at rows, as made by new_rows for words of length length.
+   Bit j of a mask is set if the word has letter at index j.
+*/
+void row_masks(const char *rows, int num_rows, int length, char letter, uint64_t *masks) {
+    get_length_kernel(length)(rows, num_rows, row_stride(length), letter, masks);
+}
+
+
+/* Return the name of the kind of kernel get_length_kernel hands out. */
+const char *get_row_kernel(void) {
+    pthread_once(&kernel_once, choose_kind);
+    return row_kernel_names[current_kind];
+}
+
+
+/* Make get_length_kernel hand out kernels of the kind called name
+   (generic, sse2 or avx2) instead of the best one, for comparing
+   them or forcing a kind, as wheel -k does. Kernels already
+   handed out are not affected. Return 0 on success, or -1 if there is
+   no such kind or this processor cannot run it.
+*/
+int set_row_kernel(const char *name) {
+    pthread_once(&kernel_once, choose_kind);
+    for (int kind = 0; kind < NUM_ROW_KERNELS; kind++) {
+        if (strcmp(row_kernel_names[kind], name) == 0 && kind_supported(kind)) {
+            current_kind = kind;
+            return 0;
+        }
+    }
+    return -1;
+}
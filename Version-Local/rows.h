@@ -0,0 +1,41 @@
+#ifndef ROWS_H
+#define ROWS_H
+
+#include <stdint.h>
+
+/* The words of a round packed into fixed-width rows: every word of the
+   round has the same length, so its characters are copied into a row
+   of row_stride(length) bytes, padded with '\0', in one contiguous
+   buffer aligned to ROW_ALIGN. Finding where a letter is in every word
+   is then a SIMD compare of whole rows instead of a walk to each word.
+*/
+
+/* Alignment of a row buffer, for the widest vector loads. */
+#define ROW_ALIGN 32
+
+/* A row kernel: store in masks[i] the mask of positions of letter in
+   row i of the num_rows rows of stride bytes at rows; bit j is row[j].
+*/
+typedef void (*row_kernel)(const char *rows, int num_rows, int stride, char letter,
+                           uint64_t *masks);
+
+/* A range of packed rows, and the kernel for the length of their words. */
+struct rows {
+    char *data; /* First row */
+    int stride; /* Bytes per row */
+    row_kernel kernel; /* From get_length_kernel */
+};
+typedef struct rows Rows;
+
+/* Names of the kinds of row kernel, for set_row_kernel, best last. */
+#define NUM_ROW_KERNELS 3
+extern const char *const row_kernel_names[NUM_ROW_KERNELS];
+
+int row_stride(int length);
+char *new_rows(char **words, int num_words, int length);
+row_kernel get_length_kernel(int length);
+void row_masks(const char *rows, int num_rows, int length, char letter, uint64_t *masks);
+const char *get_row_kernel(void);
+int set_row_kernel(const char *name);
+
+#endif
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "simulate.h"
+#include "round.h"
+#include "adversary.h"
+#include "pool.h"
+#include "util.h"
+
+/* Headless games between scripted guessers and the adversary, for load
+   testing and benchmarking the family engine. Games are dealt out in
+   chunks to a pool of threads; each game draws from its own seed, so a
+   run is repeatable whatever the number of threads.
+*/
+
+/* Games a pool task plays before merging its counts. */
+#define SIM_CHUNK 64
+
+/* Latency histogram: 8 buckets per power of two of nanoseconds. */
+#define LATENCY_BUCKETS (64 * 8)
+
+/* A scripted player: return the next letter to guess in round, or '\0'
+   if every letter has been guessed already. */
+typedef char (*guesser)(Round *round, unsigned int *seed);
+
+/* Counts of a batch of games. */
+struct sim_stats {
+    long games;
+    long adversary_wins;
+    long guesses; /* Guesses made, right or wrong */
+    long latency[LATENCY_BUCKETS]; /* Guesses by time play_guess took */
+};
+
+/* Everything the pool tasks of one simulation share. */
+struct simulation {
+    Dictionary *dict;
+    Book *book;
+    guesser guess;
+    int num_games;
+    int length; /* 0 to draw each game's length from the dictionary */
+    int guesses;
+    unsigned int seed;
+    struct sim_stats total; /* Counts of the chunks played so far */
+    pthread_mutex_t lock; /* Protects total */
+};
+
+
+/* Guess the letter that the most candidates contain. */
+static char frequency_guess(Round *round, unsigned int *seed) {
+    Histogram *hists = generate_histograms(round->candidates, round->num_candidates,
+                                           round->guessed);
+    int best = -1, best_count = -1;
+    for (int bit = 0; bit < 26; bit++) {
+        if (round->guessed & (1u << bit)) {
+            continue;
+        }
+        int count = 0;
+        for (int fam = 0; fam < hists[bit].num_families; fam++) {
+            if (hists[bit].masks[fam] != 0) {
+                count += hists[bit].counts[fam];
+            }
+        }
+        if (count > best_count) {
+            best = bit;
+            best_count = count;
+        }
+    }
+    deallocate_histograms(hists);
+    return best >= 0 ? 'a' + best : '\0';
+}
+
+
+/* Guess the letter that tells the most about the word: the one whose
+   families have the greatest entropy, taking every candidate as equally
+   likely.
+*/
+static char entropy_guess(Round *round, unsigned int *seed) {
+    Histogram *hists = generate_histograms(round->candidates, round->num_candidates,
+                                           round->guessed);
+    int best = -1;
+    double best_entropy = -1;
+    for (int bit = 0; bit < 26; bit++) {
+        if (round->guessed & (1u << bit)) {
+            continue;
+        }
+        double entropy = 0;
+        for (int fam = 0; fam < hists[bit].num_families; fam++) {
+            double p = (double) hists[bit].counts[fam] / round->num_candidates;
+            entropy -= p * log2(p);
+        }
+        if (entropy > best_entropy) {
+            best = bit;
+            best_entropy = entropy;
+        }
+    }
+    deallocate_histograms(hists);
+    return best >= 0 ? 'a' + best : '\0';
+}
+
+
+/* Guess a letter not guessed yet, at random. */
+static char random_guess(Round *round, unsigned int *seed) {
+    int left = 26 - __builtin_popcount(round->guessed);
+    if (left == 0) {
+        return '\0';
+    }
+    int pick = rand_r(seed) % left;
+    for (int bit = 0; bit < 26; bit++) {
+        if (!(round->guessed & (1u << bit)) && pick-- == 0) {
+            return 'a' + bit;
+        }
+    }
+    return '\0';
+}
+
+
+/* The guessers simulate can play, by name. */
+static const struct {
+    char *name;
+    guesser guess;
+} guessers[] = {
+    {"frequency", frequency_guess},
+    {"entropy", entropy_guess},
+    {"random", random_guess},
+};
+
+#define NUM_GUESSERS (sizeof(guessers) / sizeof(guessers[0]))
+
+
+/* Return the guesser called name, or NULL. */
+static guesser find_guesser(char *name) {
+    for (size_t i = 0; i < NUM_GUESSERS; i++) {
+        if (strcmp(guessers[i].name, name) == 0) {
+            return guessers[i].guess;
+        }
+    }
+    return NULL;
+}
+
+
+/* Return 1 if name is a guesser simulate can play, or 0. */
+int is_guesser(char *name) {
+    return find_guesser(name) != NULL;
+}
+
+
+/* Return the latency bucket of ns nanoseconds. */
+static int latency_bucket(long ns) {
+    if (ns < 8) {
+        return ns < 0 ? 0 : ns;
+    }
+    int exponent = 63 - __builtin_clzl(ns);
+    return (exponent - 2) * 8 + ((ns >> (exponent - 3)) & 7);
+}
+
+
+/* Return the smallest latency in nanoseconds that falls in bucket. */
+static long bucket_latency(int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (long) (8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+
+/* Return the number of words of dict that can be played: those of
+   length 1 or more.
+*/
+static int playable_words(Dictionary *dict) {
+    int count = 0;
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        count += dict->bucket_size[len];
+    }
+    return count;
+}
+
+
+/* Return the length of a random playable word of dict, so that lengths
+   come up as often as they do among its words. Only lengths with words
+   are drawn, and dict must have some.
+*/
+static int random_length(Dictionary *dict, unsigned int *seed) {
+    int index = rand_r(seed) % playable_words(dict);
+    int len = 1;
+    while (index >= dict->bucket_size[len]) {
+        index -= dict->bucket_size[len];
+        len++;
+    }
+    return len;
+}
+
+
+/* Play game number game of sim, with the adversary searching in search,
+   adding its counts to stats.
+*/
+static void play_game(struct simulation *sim, int game, struct search_context *search,
+                      struct sim_stats *stats) {
+    Round round;
+    unsigned int seed = sim->seed ^ (game * 2654435761u);
+    int length = sim->length > 0 ? sim->length : random_length(sim->dict, &seed);
+
+    start_round(&round, sim->dict, length, sim->guesses, sim->book, search);
+    while (!round_won(&round) && !round_lost(&round)) {
+        char guess = sim->guess(&round, &seed);
+        if (guess == '\0') {
+            break; /* Every letter guessed, and the word still not shown */
+        }
+        long start = now_ns();
+        play_guess(&round, guess);
+        stats->latency[latency_bucket(now_ns() - start)]++;
+        stats->guesses++;
+    }
+    stats->games++;
+    stats->adversary_wins += !round_won(&round);
+    end_round(&round);
+}
+
+
+/* Play chunk number task of the games of the simulation context. */
+static void play_chunk(void *context, int task) {
+    struct simulation *sim = context;
+    struct sim_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    /* Each game's adversary searches on the thread playing it. */
+    struct search_context *search = create_search_context(1);
+    for (int game = task * SIM_CHUNK; game < (task + 1) * SIM_CHUNK && game < sim->num_games;
+         game++) {
+        play_game(sim, game, search, &stats);
+    }
+    destroy_search_context(search);
+
+    pthread_mutex_lock(&sim->lock);
+    sim->total.games += stats.games;
+    sim->total.adversary_wins += stats.adversary_wins;
+    sim->total.guesses += stats.guesses;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        sim->total.latency[i] += stats.latency[i];
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+
+/* Return the latency in microseconds below which fraction of the guesses
+   counted in stats fell.
+*/
+static double latency_percentile(struct sim_stats *stats, double fraction) {
+    long rank = (long) ceil(fraction * stats->guesses);
+    long seen = 0;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (seen += stats->latency[bucket]) < rank) {
+        bucket++;
+    }
+    return bucket_latency(bucket) / 1000.0;
+}
+
+
+/* Play num_games games of words of length length (or of random lengths
+   if length is 0), with guesses wrong guesses each, between the guesser
+   called guesser_name and the adversary, on num_threads threads, and
+   print games per second, how often the adversary won and how long
+   the engine took per guess. The run is determined by seed.
+   A lookahead adversary searches on the thread playing each game.
+*/
+void simulate(Dictionary *dict, Book *book, int num_games, char *guesser_name,
+              int length, int guesses, int num_threads, unsigned int seed) {
+    struct simulation sim;
+    sim.dict = dict;
+    sim.book = book;
+    sim.guess = find_guesser(guesser_name);
+    sim.num_games = num_games;
+    sim.length = length;
+    sim.guesses = guesses;
+    sim.seed = seed;
+    memset(&sim.total, 0, sizeof(sim.total));
+    if (length == 0 && playable_words(dict) == 0) {
+        fprintf(stderr, "simulate: the dictionary has no words to play\n");
+        exit(1);
+    }
+    pthread_mutex_init(&sim.lock, NULL);
+
+    struct pool *players = create_pool(num_threads);
+    long start = now_ns();
+    pool_run(players, play_chunk, &sim, (num_games + SIM_CHUNK - 1) / SIM_CHUNK);
+    double seconds = (now_ns() - start) / 1e9;
+    destroy_pool(players);
+    pthread_mutex_destroy(&sim.lock);
+
+    struct sim_stats *total = &sim.total;
+    printf("guesser: %s\n", guesser_name);
+    printf("threads: %d\n", num_threads);
+    printf("games: %ld\n", total->games);
+    printf("seconds: %.3f\n", seconds);
+    printf("games_per_sec: %.1f\n", total->games / seconds);
+    printf("adversary_win_rate: %.4f\n", (double) total->adversary_wins / total->games);
+    printf("guesses_per_game: %.2f\n", (double) total->guesses / total->games);
+    printf("guess_latency_us: p50 %.1f p90 %.1f p99 %.1f p999 %.1f\n",
+           latency_percentile(total, 0.5), latency_percentile(total, 0.9),
+           latency_percentile(total, 0.99), latency_percentile(total, 0.999));
+}
@@ -0,0 +1,14 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include "reading.h"
+#include "book.h"
+
+/* Wrong guesses a simulated player gets if none are asked for. */
+#define DEFAULT_SIM_GUESSES 10
+
+int is_guesser(char *name);
+void simulate(Dictionary *dict, Book *book, int num_games, char *guesser_name,
+              int length, int guesses, int num_threads, unsigned int seed);
+
+#endif
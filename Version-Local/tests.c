@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "family.h"
+#include "reading.h"
+#include "rows.h"
+#include "pool.h"
+#include "book.h"
+#include "round.h"
+#include "adversary.h"
+
+/* Checks that the fast paths of the engine give what the plain ones do:
+       tests <dictionary.txt> <dictionary.bin> <opening.book>
+   - the compiled dictionary holds the words of the text one, in the same
+     order, with the same letter indexes and checksum
+   - partition_families, partition_rows and partition_rows_parallel split
+     every length's words into the families generate_families makes, and
+     extract_family and extract_rows pull out the same words
+   - rounds played with the partition cache, filled and then hit, and
+     with the opening book, keep the families of rounds played without
+   A check that fails stops the run with an error.
+*/
+
+/* Threads the parallel partitions and the rounds run on, whatever the
+   number of processors. */
+#define CHECK_THREADS 4
+
+/* Choices the partition cache holds, as in wheel. */
+#define CHECK_CACHE_SIZE 4096
+
+/* The order the rounds guess the letters in. */
+#define GUESS_ORDER "esiarntolcdupmghbyfkvwzxqj"
+
+
+static void fail(const char *what, int length, char letter) {
+    fprintf(stderr, "FAIL: %s, length %d", what, length);
+    if (letter != 0) {
+        fprintf(stderr, ", letter %c", letter);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+static void *check_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    return ptr;
+}
+
+
+/* Check that the compiled dictionary holds the words of the text one,
+   bucket by bucket in the same order, with the same letter indexes.
+*/
+static void check_dictionaries(Dictionary *text, Dictionary *compiled) {
+    if (text->compiled.header != NULL || compiled->compiled.header == NULL) {
+        fail("dictionary read in the wrong format", 0, 0);
+    }
+    if (text->num_words != compiled->num_words) {
+        fail("compiled dictionary has a different number of words", 0, 0);
+    }
+    for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+        int text_count, compiled_count;
+        char **text_words = get_words_of_length(text, len, &text_count);
+        char **compiled_words = get_words_of_length(compiled, len, &compiled_count);
+        if (text_count != compiled_count) {
+            fail("compiled dictionary has a different number of words", len, 0);
+        }
+        for (int i = 0; i < text_count; i++) {
+            char *a = text_words[i], *b = compiled_words[i];
+            int masks = __builtin_popcount(word_letters(a));
+            if (strcmp(a, b) != 0 || word_length(a) != word_length(b)
+                || word_letters(a) != word_letters(b)
+                || memcmp(word_letter_masks(a), word_letter_masks(b),
+                          sizeof(uint64_t) * masks) != 0) {
+                fail("compiled dictionary has a different word", len, 0);
+            }
+        }
+        if (text_count > 0 && compiled_words[compiled_count] != NULL) {
+            fail("compiled dictionary bucket does not end with NULL", len, 0);
+        }
+    }
+    if (get_dictionary_checksum(text) != get_dictionary_checksum(compiled)) {
+        fail("compiled dictionary has a different checksum", 0, 0);
+    }
+    printf("dictionary: %d words match\n", text->num_words);
+}
+
+
+static int compare_pointers(const void *a, const void *b) {
+    char *x = *(char **) a, *y = *(char **) b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* Return 1 if fam and other hold the same words, in any order. a and b
+   have room for the words of either.
+*/
+static int same_words(Family *fam, Family *other, char **a, char **b) {
+    if (fam->num_words != other->num_words) {
+        return 0;
+    }
+    memcpy(a, fam->word_ptrs, sizeof(char *) * fam->num_words);
+    memcpy(b, other->word_ptrs, sizeof(char *) * other->num_words);
+    qsort(a, fam->num_words, sizeof(char *), compare_pointers);
+    qsort(b, other->num_words, sizeof(char *), compare_pointers);
+    return memcmp(a, b, sizeof(char *) * fam->num_words) == 0;
+}
+
+
+/* Check that fam_list holds the families of expected, in any order, and
+   terminate with an error naming name if it does not.
+*/
+static void check_partition(const char *name, Family *fam_list, Family *expected,
+                            int length, char letter, char **a, char **b) {
+    int count = 0, expected_count = 0;
+    for (Family *fam = expected; fam != NULL; fam = fam->next) {
+        expected_count++;
+    }
+    for (Family *fam = fam_list; fam != NULL; fam = fam->next, count++) {
+        Family *match = expected;
+        while (match != NULL && match->mask != fam->mask) {
+            match = match->next;
+        }
+        if (match == NULL || fam->length != length || !same_words(fam, match, a, b)) {
+            fail(name, length, letter);
+        }
+    }
+    if (count != expected_count) {
+        fail(name, length, letter);
+    }
+}
+
+
+/* Check that rows still holds the num_words words of word_list, in the
+   same order, after a partition or extract moved them.
+*/
+static void check_rows(const char *name, char **word_list, Rows *rows, int num_words,
+                       int length, char letter) {
+    for (int i = 0; i < num_words; i++) {
+        if (memcmp(rows->data + (size_t) i * rows->stride, word_list[i], length) != 0) {
+            fail(name, length, letter);
+        }
+    }
+}
+
+
+/* Check every partition of the words of each length against
+   generate_families, for every letter. The words of the most common
+   length are repeated to PARALLEL_MIN_WORDS at least, so that
+   partition_rows_parallel does take the parallel path for them.
+*/
+static void check_partitions(Dictionary *dict, struct pool *pool) {
+    int checked = 0, common = 1, most = 0;
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        int count;
+        get_words_of_length(dict, len, &count);
+        if (count > most) {
+            common = len;
+            most = count;
+        }
+    }
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        int count;
+        char **source = get_words_of_length(dict, len, &count);
+        if (count == 0) {
+            continue;
+        }
+        int total = len != common ? count : (PARALLEL_MIN_WORDS + count - 1) / count * count;
+        char **words = check_malloc(sizeof(char *) * (total + 1));
+        char **scratch = check_malloc(sizeof(char *) * total);
+        char **a = check_malloc(sizeof(char *) * total);
+        char **b = check_malloc(sizeof(char *) * total);
+        for (int i = 0; i < total; i++) {
+            words[i] = source[i % count];
+        }
+        words[total] = NULL;
+        Rows rows = {NULL, row_stride(len), get_length_kernel(len)};
+
+        for (char letter = 'a'; letter <= 'z'; letter++) {
+            Family *expected = generate_families(words, letter);
+            Family *fam_list;
+
+            memcpy(scratch, words, sizeof(char *) * total);
+            fam_list = partition_families(scratch, total, letter);
+            check_partition("partition_families", fam_list, expected, len, letter, a, b);
+            deallocate_families(fam_list);
+
+            memcpy(scratch, words, sizeof(char *) * total);
+            rows.data = new_rows(scratch, total, len);
+            fam_list = partition_rows(scratch, &rows, total, letter);
+            check_partition("partition_rows", fam_list, expected, len, letter, a, b);
+            check_rows("partition_rows", scratch, &rows, total, len, letter);
+            deallocate_families(fam_list);
+            free(rows.data);
+
+            memcpy(scratch, words, sizeof(char *) * total);
+            rows.data = new_rows(scratch, total, len);
+            fam_list = partition_rows_parallel(scratch, &rows, total, letter, pool);
+            check_partition("partition_rows_parallel", fam_list, expected, len, letter, a, b);
+            check_rows("partition_rows_parallel", scratch, &rows, total, len, letter);
+            deallocate_families(fam_list);
+
+            /* The family a cache or book hit pulls out, from the rows
+               moved by the partition above and from plain words. */
+            Family *biggest = find_biggest_family(expected);
+            fam_list = extract_rows(scratch, &rows, total, letter, biggest->mask);
+            if (fam_list->mask != biggest->mask || !same_words(fam_list, biggest, a, b)) {
+                fail("extract_rows", len, letter);
+            }
+            check_rows("extract_rows", scratch, &rows, total, len, letter);
+            deallocate_families(fam_list);
+            free(rows.data);
+
+            memcpy(scratch, words, sizeof(char *) * total);
+            fam_list = extract_family(scratch, total, letter, biggest->mask);
+            if (fam_list->mask != biggest->mask || !same_words(fam_list, biggest, a, b)) {
+                fail("extract_family", len, letter);
+            }
+            deallocate_families(fam_list);
+
+            deallocate_families(expected);
+            checked++;
+        }
+        free(words);
+        free(scratch);
+        free(a);
+        free(b);
+    }
+    printf("partitions: %d lengths and letters match\n", checked);
+}
+
+
+/* What a round showed the player after each guess. */
+struct round_log {
+    int num_guesses;
+    char patterns[26][MAX_WORD_LENGTH + 1];
+    int num_candidates[26];
+};
+
+
+/* Play a round on the words of each length of dict, guessing the letters
+   in GUESS_ORDER until the word is revealed, and record it in logs.
+*/
+static void play_rounds(Dictionary *dict, Book *book, struct search_context *search,
+                        struct round_log *logs) {
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        Round round;
+        int count;
+        struct round_log *log = &logs[len];
+        log->num_guesses = 0;
+        if (get_words_of_length(dict, len, &count) == NULL || count == 0) {
+            continue;
+        }
+        start_round(&round, dict, len, 26, book, search);
+        for (const char *guess = GUESS_ORDER; *guess != '\0' && !round_won(&round); guess++) {
+            play_guess(&round, *guess);
+            strcpy(log->patterns[log->num_guesses], round.pattern);
+            log->num_candidates[log->num_guesses] = round.num_candidates;
+            log->num_guesses++;
+        }
+        end_round(&round);
+    }
+}
+
+
+/* Check that the rounds of logs went as those of expected, and terminate
+   with an error naming name if they did not.
+*/
+static void check_rounds(const char *name, struct round_log *logs,
+                         struct round_log *expected) {
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        if (logs[len].num_guesses != expected[len].num_guesses) {
+            fail(name, len, 0);
+        }
+        for (int i = 0; i < expected[len].num_guesses; i++) {
+            if (strcmp(logs[len].patterns[i], expected[len].patterns[i]) != 0
+                || logs[len].num_candidates[i] != expected[len].num_candidates[i]) {
+                fail(name, len, GUESS_ORDER[i]);
+            }
+        }
+    }
+}
+
+
+/* Check that the first guess of every length is found by lookup, which
+   is lookup_partition if book is NULL, so the rounds that follow do take
+   the cache or book path.
+*/
+static void check_first_guess_found(const char *name, Dictionary *dict, Book *book) {
+    for (int len = 1; len <= MAX_WORD_LENGTH; len++) {
+        int count, num_words;
+        uint64_t mask;
+        Position pos;
+        char pattern[MAX_WORD_LENGTH + 1];
+        if (get_words_of_length(dict, len, &count) == NULL || count == 0) {
+            continue;
+        }
+        memset(pattern, '-', len);
+        pattern[len] = '\0';
+        init_position(&pos, len, 0, 0, pattern);
+        int found = book != NULL ? lookup_book(book, &pos, GUESS_ORDER[0], &mask, &num_words)
+                                 : lookup_partition(&pos, GUESS_ORDER[0], &mask, &num_words);
+        if (!found) {
+            fail(name, len, GUESS_ORDER[0]);
+        }
+    }
+}
+
+
+/* Check that rounds played from the partition cache, as it is filled and
+   once it is full, and from the opening book, go as rounds without them.
+*/
+static void check_cached_rounds(Dictionary *dict, char *book_file) {
+    static struct round_log plain[MAX_WORD_LENGTH + 1], logs[MAX_WORD_LENGTH + 1];
+    uint64_t checksum = get_dictionary_checksum(dict);
+    init_adversary(1, DEFAULT_BUDGET_MS);
+    struct search_context *search = create_search_context(CHECK_THREADS);
+
+    play_rounds(dict, NULL, search, plain);
+
+    init_partition_cache(CHECK_CACHE_SIZE, NULL, checksum, 1);
+    play_rounds(dict, NULL, search, logs);
+    check_rounds("rounds filling the partition cache", logs, plain);
+    check_first_guess_found("partition cache missed", dict, NULL);
+    play_rounds(dict, NULL, search, logs);
+    check_rounds("rounds hitting the partition cache", logs, plain);
+    deallocate_partition_cache();
+
+    Book *book = open_book(book_file, checksum);
+    if (book == NULL) {
+        fail("opening book not built from this dictionary", 0, 0);
+    }
+    check_first_guess_found("opening book missed", dict, book);
+    play_rounds(dict, book, search, logs);
+    check_rounds("rounds from the opening book", logs, plain);
+    close_book(book);
+
+    destroy_search_context(search);
+    printf("rounds: the cache and the book keep the families of a plain round\n");
+}
+
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <dictionary.txt> <dictionary.bin> <opening.book>\n",
+                argv[0]);
+        exit(1);
+    }
+    Dictionary *text = read_dictionary(argv[1]);
+    Dictionary *compiled = read_dictionary(argv[2]);
+    init_family(1024);
+    check_dictionaries(text, compiled);
+
+    struct pool *pool = create_pool(CHECK_THREADS);
+    check_partitions(compiled, pool);
+    destroy_pool(pool);
+
+    check_cached_rounds(compiled, argv[3]);
+
+    deallocate_dictionary(text);
+    deallocate_dictionary(compiled);
+    printf("all checks passed\n");
+    return 0;
+}
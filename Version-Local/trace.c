@@ -0,0 +1,209 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "util.h"
+
+/* Names of the phases in the trace. */
+static const char *phase_names[NUM_PHASES] = {
+    "deallocate", "lookup", "extract", "partition", "choose", "store"
+};
+
+/* The guess a thread is in: when each phase started, how long it took
+   and how many allocations it made.
+*/
+struct guess_trace {
+    int active; /* 1 between trace_begin_guess and trace_end_guess */
+    long start_ns;
+    long mark_ns; /* End of the last phase recorded */
+    long phase_start[NUM_PHASES];
+    long phase_ns[NUM_PHASES];
+    long phase_allocs[NUM_PHASES];
+    long pending_allocs; /* Made since the last phase recorded */
+    long allocs;
+};
+
+/* Totals of the round a thread is in. */
+struct round_trace {
+    int guesses;
+    int first_candidates; /* Candidates before the first guess */
+    int families; /* Families made, over all guesses */
+    long phase_ns[NUM_PHASES];
+    long allocs; /* Including those made when the round started */
+};
+
+static __thread struct guess_trace guess;
+static __thread struct round_trace round_totals;
+
+/* The guess of another thread that the allocations of the calling
+   thread count toward, while it runs a pool task for that guess. */
+static __thread struct guess_trace *adopted = NULL;
+
+/* Id of the calling thread in the trace; 0 until it writes an event. */
+static __thread int trace_tid = 0;
+static int num_tids = 0;
+
+/* The trace file, opened on the first event and shared by all threads. */
+static FILE *trace_fp = NULL;
+static int num_events = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* End the trace file, so that it is valid JSON. Run at exit. */
+static void close_trace(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fp != NULL) {
+        fprintf(trace_fp, "\n]}\n");
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+/* Write a complete event called name, from start_ns lasting dur_ns, to
+   the trace file, with args (a JSON object's members, or "") attached.
+   trace_lock must be held.
+*/
+static void write_event(const char *name, long start_ns, long dur_ns, const char *args) {
+    if (trace_fp == NULL) {
+        trace_fp = fopen(TRACE_FILE, "w");
+        if (trace_fp == NULL) {
+            perror("fopen");
+            exit(1);
+        }
+        fprintf(trace_fp, "{\"traceEvents\": [");
+        atexit(close_trace);
+    }
+    if (trace_tid == 0) {
+        trace_tid = ++num_tids;
+    }
+    fprintf(trace_fp, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+            "\"ts\": %.3f, \"dur\": %.3f, \"args\": {%s}}",
+            num_events++ > 0 ? "," : "", name, trace_tid,
+            start_ns / 1000.0, dur_ns / 1000.0, args);
+}
+
+
+/* Start timing a guess. */
+void trace_begin_guess(void) {
+    guess.active = 1;
+    guess.start_ns = now_ns();
+    guess.mark_ns = guess.start_ns;
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        guess.phase_ns[phase] = 0;
+        guess.phase_start[phase] = 0;
+        guess.phase_allocs[phase] = 0;
+    }
+    guess.pending_allocs = 0;
+    guess.allocs = 0;
+}
+
+
+/* Charge the time since the last phase ended, and the allocations made
+   in it, to phase.
+*/
+void trace_phase(enum trace_phase phase) {
+    long now = now_ns();
+    if (guess.phase_ns[phase] == 0) {
+        guess.phase_start[phase] = guess.mark_ns;
+    }
+    guess.phase_ns[phase] += now - guess.mark_ns;
+    guess.phase_allocs[phase] += guess.pending_allocs;
+    guess.pending_allocs = 0;
+    guess.mark_ns = now;
+}
+
+
+/* Count an allocation made by the engine: to the phase in progress
+   during a guess, which may be the guess of another thread that the
+   calling thread is running a pool task for, and to the round outside
+   one. The threads of a pool count into one guess at once, so the
+   counts of a guess are added to atomically.
+*/
+void trace_alloc(void) {
+    struct guess_trace *counts = guess.active || adopted == NULL ? &guess : adopted;
+    if (counts->active) {
+        __atomic_add_fetch(&counts->pending_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&counts->allocs, 1, __ATOMIC_RELAXED);
+    } else {
+        round_totals.allocs++;
+    }
+}
+
+
+/* Return the guess that pool tasks started now by the calling thread
+   should count their allocations toward: its own, the one it is running
+   a task for, or NULL if it is in neither.
+*/
+void *trace_owner(void) {
+    return guess.active ? &guess : adopted;
+}
+
+
+/* Count the allocations of the calling thread toward owner, from
+   trace_owner on another thread, until called again with NULL.
+*/
+void trace_adopt(void *owner) {
+    adopted = owner;
+}
+
+
+/* End the guess of letter, which split candidates words into families
+   families and kept kept of them: add it to the round and the trace.
+*/
+void trace_end_guess(char letter, int candidates, int families, int kept) {
+    char args[160];
+    long end = now_ns();
+
+    guess.active = 0;
+    if (round_totals.guesses++ == 0) {
+        round_totals.first_candidates = candidates;
+    }
+    round_totals.families += families;
+    round_totals.allocs += guess.allocs;
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        round_totals.phase_ns[phase] += guess.phase_ns[phase];
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    snprintf(args, sizeof(args), "\"letter\": \"%c\", \"candidates\": %d, \"families\": %d, "
+             "\"kept\": %d, \"allocs\": %ld", letter, candidates, families, kept, guess.allocs);
+    write_event("guess", guess.start_ns, end - guess.start_ns, args);
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        if (guess.phase_ns[phase] > 0) {
+            snprintf(args, sizeof(args), "\"allocs\": %ld", guess.phase_allocs[phase]);
+            write_event(phase_names[phase], guess.phase_start[phase], guess.phase_ns[phase],
+                        args);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+/* Print the summary of the round of words of length length that just
+   ended, which the player won if won is 1, and start a new one.
+*/
+void trace_end_round(int length, int won) {
+    long total = 0;
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        total += round_totals.phase_ns[phase];
+    }
+    pthread_mutex_lock(&trace_lock);
+    fprintf(stderr, "trace: round of length %d %s: %d guesses, %d candidates, "
+            "%d families, %ld allocations, %.3f ms\n",
+            length, won ? "won" : "lost", round_totals.guesses,
+            round_totals.first_candidates, round_totals.families, round_totals.allocs,
+            total / 1e6);
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        fprintf(stderr, "trace:   %-10s %10.3f ms\n", phase_names[phase],
+                round_totals.phase_ns[phase] / 1e6);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    round_totals = (struct round_trace) {0};
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Instrumentation of the guesses of a round, compiled in with
+   make TRACE=1 (after a make clean). Without it, every TRACE_ macro
+   expands to nothing.
+
+   Each guess records the nanoseconds spent in every phase of the
+   engine, the candidates before and after it, the number of families
+   and the allocations made in every phase; a round also counts those
+   made when it starts. Every malloc, calloc, realloc or posix_memalign
+   the engine makes while playing is counted with TRACE_ALLOC, including
+   those of pool tasks run for a guess, on whatever thread they run.
+   A summary of every round is printed to stderr, and every guess and
+   phase is written to TRACE_FILE in the Chrome trace event format
+   (chrome://tracing, or ui.perfetto.dev).
+*/
+
+/* File the trace events are written to. */
+#define TRACE_FILE "trace.json"
+
+/* The phases of a guess, in the order they run. */
+enum trace_phase {
+    PHASE_DEALLOCATE, /* Tearing down the previous guess's families */
+    PHASE_LOOKUP, /* Looking the move up in the book and cache */
+    PHASE_EXTRACT, /* Pulling a looked-up family out of the candidates */
+    PHASE_PARTITION, /* partition_rows_parallel */
+    PHASE_CHOOSE, /* choose_family, including find_biggest_family */
+    PHASE_STORE, /* Entering the choice into the cache */
+    NUM_PHASES
+};
+
+#ifdef TRACE
+
+void trace_begin_guess(void);
+void trace_phase(enum trace_phase phase);
+void trace_alloc(void);
+void *trace_owner(void);
+void trace_adopt(void *owner);
+void trace_end_guess(char letter, int candidates, int families, int kept);
+void trace_end_round(int length, int won);
+
+#define TRACE_BEGIN_GUESS() trace_begin_guess()
+#define TRACE_PHASE(phase) trace_phase(phase)
+#define TRACE_ALLOC() trace_alloc()
+#define TRACE_OWNER() trace_owner()
+#define TRACE_ADOPT(owner) trace_adopt(owner)
+#define TRACE_END_GUESS(letter, candidates, families, kept) \
+    trace_end_guess(letter, candidates, families, kept)
+#define TRACE_END_ROUND(length, won) trace_end_round(length, won)
+
+#else
+
+#define TRACE_BEGIN_GUESS() ((void) 0)
+#define TRACE_PHASE(phase) ((void) 0)
+#define TRACE_ALLOC() ((void) 0)
+#define TRACE_OWNER() ((void *) 0)
+#define TRACE_ADOPT(owner) ((void) (owner))
+#define TRACE_END_GUESS(letter, candidates, families, kept) ((void) 0)
+#define TRACE_END_ROUND(length, won) ((void) 0)
+
+#endif
+
+#endif
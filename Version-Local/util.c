@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util.h"
+
+/* Return the current time in nanoseconds, from the monotonic clock. */
+long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+/* Write the size bytes at data to fp, or terminate on failure. */
+void write_or_die(const void *data, size_t size, FILE *fp) {
+    if (size > 0 && fwrite(data, size, 1, fp) != 1) {
+        perror("fwrite");
+        exit(1);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdio.h>
+
+long now_ns(void);
+void write_or_die(const void *data, size_t size, FILE *fp);
+
+#endif
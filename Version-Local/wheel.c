@@ -1,56 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include "family.h"
 #include "reading.h"
+#include "adversary.h"
+#include "book.h"
+#include "round.h"
+#include "simulate.h"
+#include "rows.h"
 
 #define BUF_SIZE    256
-
-/* Starting with words (returned by read_words), generate and return
-   a new word list with only those words of length len. Also, fill
-   words_remaining with the number of words in the new word list.
-*/
-char **prune_word_list(char **words, int len, int *words_remaining) {
-    char **word_list;
-    int cache_index = 0;
-    *words_remaining = 0;
-    char *word = words[cache_index];
-    while (word != NULL) {
-        if (strlen(word) == len) {
-            *words_remaining += 1;
-        }
-        cache_index += 1;
-        word = words[cache_index];
-    }
-
-    word_list = malloc(sizeof(char *) * (*words_remaining + 1));
-    if (word_list == NULL) {
-        perror("malloc error in prune_word_list");
-        exit(1);
-    }
-    // SET THE LAST TO NULL
-    word_list[*words_remaining] = NULL;
-
-    int i = 0;
-    word = words[0];
-    cache_index = 0;
-    while (word != NULL) {
-        if (strlen(word) == len) {
-            word_list[i] = word;
-            i += 1;
-        }
-        cache_index += 1;
-        word = words[cache_index];
-    }
-    word_list[*words_remaining] = NULL;
-    return word_list;
-}
-
-
-/* Free memory acquired by prune_word_list.
+#define CACHE_SIZE  4096 /* Choices kept in the partition cache */
+#define USAGE "Usage: %s [-d depth] [-t threads] [-b budget_ms] [-c cache_file] [-k kernel]\n" \
+              "         [-s games [-g guesser] [-L length] [-n guesses] [-r seed]]\n"
+
+/* Return the word list of dict with only those words of length len,
+   and fill words_remaining with the number of words in it. The words are
+   bucketed by length when the dictionary is read, so this is a lookup;
+   the list belongs to dict and must not be freed.
 */
-void deallocate_pruned_word_list(char **word_list) {
-    free(word_list);
+char **prune_word_list(Dictionary *dict, int len, int *words_remaining) {
+    return get_words_of_length(dict, len, words_remaining);
 }
 
 
@@ -64,7 +36,7 @@ void deallocate_pruned_word_list(char **word_list) {
    If the user enters a non-numeric string, then ask the user to provide
    a different word length as above.
 */
-char **get_word_list_of_length(char **words, int *len) {
+char **get_word_list_of_length(Dictionary *dict, int *len) {
     char buffer[BUF_SIZE];
     char *remainder;
     printf("Length of words to use? ");
@@ -74,15 +46,14 @@ char **get_word_list_of_length(char **words, int *len) {
     }
     *len = strtol(buffer, &remainder, 10);
     if (*remainder != '\n') { // The input was not all numeric
-        return get_word_list_of_length(words, len);
+        return get_word_list_of_length(dict, len);
     }
-    /* signature reminder: char** prune_word_list(char**, int, int *)  */
+    /* signature reminder: char** prune_word_list(Dictionary*, int, int *)  */
     int family_member_count;
-    char **word_list = prune_word_list(words, *len, &family_member_count);
+    char **word_list = prune_word_list(dict, *len, &family_member_count);
     if (family_member_count < 1) {
-        deallocate_pruned_word_list(word_list);
         printf("There are no words of that length.\n");
-        return get_word_list_of_length(words, len);
+        return get_word_list_of_length(dict, len);
     }
     return word_list;
 }
@@ -122,21 +93,19 @@ char get_next_guess(char *letters_guessed) {
 }
 
 
-/*Play one game of desperate_hangman */
-void play_round(char **words) {
-    Family *famlist = NULL, *biggest_fam;
+/*Play one game of desperate_hangman, taking the first moves from book
+  if it is not NULL, with the adversary searching in search*/
+void play_round(Dictionary *dict, Book *book, struct search_context *search) {
+    Round round;
     char input_buffer[BUF_SIZE];
-    char **word_list = NULL;
-    int len, i, found;
+    int len;
     int guesses = 0;
     int game_over = 0; /*1 = game is over*/
     char guess;
-    char *current_word; /*Representation of current word; each blank is a - */
-    char *sig; /*Signature of a family*/
     char letters_guessed[26] = {'\0'}; /*Guesses so far*/
 
-    /*Get a valid word_list from length (one that has at least one word)*/
-    word_list = get_word_list_of_length(words, &len);
+    /*Get a valid length (one that has at least one word).*/
+    get_word_list_of_length(dict, &len);
 
     while (guesses < 1 || guesses > 26) {
         printf("How many guesses would you like?\n");
@@ -155,80 +124,152 @@ void play_round(char **words) {
     }
 
     /*Word starts off as all unknowns*/
-    current_word = malloc(len + 1);
-    if (current_word == NULL) {
-        perror("malloc");
-        exit(1);
-    }
-    memset(current_word, '-', len);
-    current_word[len] = '\0';
+    start_round(&round, dict, len, guesses, book, search);
 
     while (!game_over) {
-        printf("Guesses remaining: %d\n", guesses);
-        printf("Word: %s\n", current_word);
+        printf("Guesses remaining: %d\n", round.guesses);
+        printf("Word: %s\n", round.pattern);
         guess = get_next_guess(letters_guessed);
-        deallocate_families(famlist);
-        famlist = generate_families(word_list, guess);
-        biggest_fam = find_biggest_family(famlist);
-        sig = get_family_signature(biggest_fam);
-        /*Search signature for letters in current_word*/
-        found = 0;
-        i = 0;
-        while (*sig) {
-            if (*sig == guess) {
-                found = 1;
-                current_word[i] = guess;
-            }
-            sig++;
-            i++;
-        }
-        if (found) {
+        if (play_guess(&round, guess)) {
             printf("Good guess!\n");
-            if (!strchr(current_word, '-')) {
-                printf("You win! The word was %s.\n", current_word);
+            if (round_won(&round)) {
+                printf("You win! The word was %s.\n", round.pattern);
                 game_over = 1;
             }
         } else {
             printf("There is no %c in the word.\n", guess);
-            guesses--;
-            game_over = guesses <= 0;
+            game_over = round_lost(&round);
         }
-        deallocate_pruned_word_list(word_list);
-        word_list = get_new_word_list(biggest_fam);
     }
 
-    if (guesses == 0) {
+    if (round_lost(&round)) {
         printf("You lose! The word was %s.\n",
-               get_random_word_from_family(biggest_fam));
+               get_random_word_from_family(round.kept));
     }
 
-    deallocate_pruned_word_list(word_list);
-    free(current_word);
-    deallocate_families(famlist);
+    end_round(&round);
 }
 
 
 /* Read words, initialize families, and play as long as
-   the user answers 'y'. */
-int main(void) {
+   the user answers 'y', or play games headless with -s.
+   Usage: wheel [-d depth] [-t threads] [-b budget_ms] [-c cache_file] [-k kernel]
+                [-s games [-g guesser] [-L length] [-n guesses] [-r seed]]
+     -d  number of guesses the adversary looks ahead (1 is greedy)
+     -t  number of threads the adversary searches on, or simulated games run on
+     -b  milliseconds the adversary may take per guess
+     -c  file the partition cache is loaded from and saved to
+     -k  row kernel to find signatures with: generic, sse2 or avx2
+         (default: the best this processor runs)
+     -s  simulate this many games against a scripted guesser and report
+     -g  guesser to simulate: frequency (default), entropy or random
+     -L  word length of the simulated games (default: random per game)
+     -n  wrong guesses allowed per simulated game
+     -r  seed of the simulated games (default: the time) */
+int main(int argc, char **argv) {
     char again;
-    char **words;
+    Dictionary *dict;
+    Book *book = NULL;
+    int depth = DEFAULT_DEPTH;
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int budget_ms = DEFAULT_BUDGET_MS;
+    char *cache_file = NULL;
+    int num_games = 0;
+    char *guesser = "frequency";
+    int length = 0;
+    int guesses = DEFAULT_SIM_GUESSES;
+    unsigned int seed = time(NULL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:b:c:k:s:g:L:n:r:")) != -1) {
+        switch (opt) {
+        case 'd':
+            depth = strtol(optarg, NULL, 10);
+            break;
+        case 't':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        case 'b':
+            budget_ms = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            cache_file = optarg;
+            break;
+        case 'k':
+            if (set_row_kernel(optarg) == -1) {
+                fprintf(stderr, "%s: this processor has no row kernel %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            num_games = strtol(optarg, NULL, 10);
+            break;
+        case 'g':
+            guesser = optarg;
+            break;
+        case 'L':
+            length = strtol(optarg, NULL, 10);
+            break;
+        case 'n':
+            guesses = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(1);
+        }
+    }
+    if (depth < 1 || num_threads < 1 || budget_ms < 1) {
+        fprintf(stderr, "%s: depth, threads and budget must be positive\n", argv[0]);
+        exit(1);
+    }
+    if (num_games < 0 || guesses < 1 || guesses > 26 || !is_guesser(guesser)) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
 
-    words = read_words("dictionary.txt");
+    /* Prefer the compiled dictionary, which is mapped instead of parsed. */
+    if (access(COMPILED_DICTIONARY, R_OK) == 0) {
+        dict = read_dictionary(COMPILED_DICTIONARY);
+    } else {
+        dict = read_dictionary(DICTIONARY);
+    }
+    uint64_t checksum = get_dictionary_checksum(dict);
     init_family(1024);
+    init_adversary(depth, budget_ms);
+    init_partition_cache(CACHE_SIZE, cache_file, checksum, depth);
+    /* The book holds the greedy adversary's moves. */
+    if (depth == 1) {
+        book = open_book(OPENING_BOOK, checksum);
+    }
 
-    do {
-        play_round(words);
-        printf("Play another round (y/n)? ");
-        if (scanf(" %c", &again) != 1) {
-            perror("scanf");
-            break;
+    if (num_games > 0) {
+        int count;
+        if (length != 0 && (get_words_of_length(dict, length, &count) == NULL || count < 1)) {
+            fprintf(stderr, "%s: there are no words of length %d\n", argv[0], length);
+            exit(1);
         }
-        // In case of valid input, "consume" the newline character.
-        getchar();
+        simulate(dict, book, num_games, guesser, length, guesses, num_threads, seed);
+    } else {
+        struct search_context *search = create_search_context(num_threads);
+        do {
+            play_round(dict, book, search);
+            printf("Play another round (y/n)? ");
+            if (scanf(" %c", &again) != 1) {
+                perror("scanf");
+                break;
+            }
+            // In case of valid input, "consume" the newline character.
+            getchar();
 
-    } while (again == 'y');
+        } while (again == 'y');
+        destroy_search_context(search);
+    }
 
-    deallocate_words(words);
+    deallocate_partition_cache();
+    close_book(book);
+    deallocate_dictionary(dict);
     return 0;
 }
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gameplay.h"
 
@@ -25,42 +28,117 @@ char *status_message(char *msg, struct game_state *game) {
 }
 
 
-/* Initialize the gameboard: 
- *    - initialize dictionary
- *    - select a random word to guess from the dictionary file
- *    - set guess to all dashes ('-')
- *    - initialize the other fields
- * We can't initialize head and has_next_turn because these will have
- * different values when we use init_game to create a new game after one
- * has already been played
+/* Map the text dictionary dict_name, with one word per line, into dict
+ * and build the table of where its lines start, in a single pass, so a
+ * word is picked by index as from a compiled dictionary.
  */
-void init_game(struct game_state *game, char *dict_name) {
-    char buf[MAX_WORD];
-    if(game->dict.fp != NULL) {
-        rewind(game->dict.fp);
-    } else {
-        game->dict.fp = fopen(dict_name, "r");
-        if(game->dict.fp == NULL) {
-            perror("Opening dictionary");
+void load_text_dictionary(struct dictionary *dict, char *dict_name) {
+    struct stat st;
+    int fd = open(dict_name, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        exit(1);
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(1);
+    }
+    dict->text = NULL;
+    dict->text_size = st.st_size;
+    if (dict->text_size > 0) {
+        dict->text = mmap(NULL, dict->text_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (dict->text == MAP_FAILED) {
+            perror("mmap");
             exit(1);
         }
-    } 
+    }
+    close(fd);
 
-    int index = random() % game->dict.size;
-    printf("Looking for word at index %d\n", index);
-    for(int i = 0; i <= index; i++) {
-        if(!fgets(buf, MAX_WORD, game->dict.fp)){
-            fprintf(stderr,"File ended before we found the entry index %d",index);
-            exit(1);
+    // Grow the table geometrically; one extra entry marks the end
+    size_t capacity = 1024;
+    dict->lines = malloc(capacity * sizeof(size_t));
+    if (dict->lines == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    dict->size = 0;
+    const char *line = dict->text, *end = dict->text + dict->text_size;
+    while (line < end) {
+        if (dict->size + 1 == capacity) {
+            capacity *= 2;
+            dict->lines = realloc(dict->lines, capacity * sizeof(size_t));
+            if (dict->lines == NULL) {
+                perror("realloc");
+                exit(1);
+            }
         }
-    } 
+        dict->lines[dict->size++] = line - dict->text;
+        const char *newline = memchr(line, '\n', end - line);
+        line = newline != NULL ? newline + 1 : end;
+    }
+    dict->lines[dict->size] = dict->text_size;
+}
 
-    // Found word
-    if(buf[strlen(buf) - 1] == '\n') {  // from a unix file
-        buf[strlen(buf) - 1] = '\0';
+
+/* Open the dictionary dict_name. A dictionary compiled by mkdict is
+ * mapped into memory; otherwise dict_name is read as text with one word
+ * per line, and its lines are indexed. Either way a word is then picked
+ * by index, without reading the file again.
+ */
+void init_dictionary(struct dictionary *dict, char *dict_name) {
+    if (open_dict_file(dict_name, &dict->compiled) == 0) {
+        dict->size = dict->compiled.header->num_words;
     } else {
+        dict->compiled.header = NULL;
+        load_text_dictionary(dict, dict_name);
+    }
+    if (dict->size == 0) {
+        fprintf(stderr, "%s: the dictionary has no words\n", dict_name);
+        exit(1);
+    }
+}
+
+
+/* Copy word number index of dict into buf, which has room for MAX_WORD
+ * characters, without its line ending.
+ */
+void get_dictionary_word(struct dictionary *dict, int index, char *buf) {
+    if (dict->compiled.header != NULL) {
+        strncpy(buf, dict_file_word(&dict->compiled, index), MAX_WORD);
+        buf[MAX_WORD-1] = '\0';
+        return;
+    }
+    const char *word = dict->text + dict->lines[index];
+    size_t len = dict->lines[index + 1] - dict->lines[index];
+    if (len > 0 && word[len - 1] == '\n') {  // from a unix file
+        len--;
+    }
+    if (len > 0 && word[len - 1] == '\r') {
         fprintf(stderr, "The dictionary file does not appear to have Unix line endings\n");
+        len--;
+    }
+    if (len > MAX_WORD - 1) {
+        len = MAX_WORD - 1;
     }
+    memcpy(buf, word, len);
+    buf[len] = '\0';
+}
+
+
+/* Initialize the gameboard: 
+ *    - select a random word to guess from the dictionary, by index, drawn
+ *      with rand_r from *seed so that threads do not share random()'s lock
+ *    - set guess to all dashes ('-')
+ *    - initialize the other fields
+ * We can't initialize head and has_next_turn because these will have
+ * different values when we use init_game to create a new game after one
+ * has already been played
+ */
+void init_game(struct game_state *game, unsigned int *seed) {
+    char buf[MAX_WORD];
+    int index = rand_r(seed) % game->dict->size;
+    LOG("Looking for word at index %d\n", index);
+    get_dictionary_word(game->dict, index, buf);
     strncpy(game->word, buf, MAX_WORD);
     game->word[MAX_WORD-1] = '\0';
     for(int j = 0; j < strlen(game->word); j++) {
@@ -74,23 +152,3 @@ void init_game(struct game_state *game, char *dict_name) {
     game->guesses_left = MAX_GUESSES;
 
 }
-
-
-/* Return the number of lines in the file
- */
-int get_file_length(char *filename) {
-    char buf[MAX_MSG];
-    int count = 0;
-    FILE *fp;
-    if((fp = fopen(filename, "r")) == NULL) {
-        perror("open");
-        exit(1);
-    }
-    
-    while(fgets(buf, MAX_MSG, fp) != NULL) {
-        count++;
-    }
-    
-    fclose(fp);
-    return count;
-}
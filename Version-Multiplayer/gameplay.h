@@ -1,13 +1,24 @@
 #include <netinet/in.h>
+#include <stdio.h>
+#include "dictfile.h"
 
 #define MAX_NAME 30  
 #define MAX_MSG 128
 #define MAX_WORD 20
 #define MAX_BUF 256
+#define MAX_BACKLOG 65536 // Most output queued for a client before it is dropped
 #define MAX_GUESSES 4
 #define NUM_LETTERS 26
+#define ROOM_SIZE 8 // Most players in one game room
+// Report what the server does, one line per event, only if it was started
+// with -v: the output goes through stdio's lock, which every shard shares
+#define LOG(...) do { if (verbose) printf(__VA_ARGS__); } while (0)
+extern int verbose;
+
 #define WELCOME_MSG "Welcome to our word game. What is your name? "
 
+struct game_state;
+
 struct client {
     int fd;
     struct in_addr ipaddr;
@@ -15,12 +26,24 @@ struct client {
     char name[MAX_NAME];
     char inbuf[MAX_BUF];  // Used to hold input from the client
     char *in_ptr;         // A pointer into inbuf to help with partial reads
+    struct client *next_removed; // Next client waiting to be freed
+    struct game_state *room; // The game played in, NULL until named
+    char *out;            // Output not yet written, from out + out_start
+    int out_start;
+    int out_len;
+    int out_size;         // Bytes allocated for out
+    int dropped;          // 1 if the client is to be disconnected
+    struct client *next_dropped; // Next client waiting to be disconnected
 };
 
-// Information about the dictionary used to pick random word
+// Information about the dictionary used to pick random word. It is only
+// read once loaded, so every room and every thread can share it
 struct dictionary {
-    FILE *fp;
-    int size;
+    int size;                  // Number of words
+    struct dict_file compiled; // header is NULL for a text dictionary
+    const char *text;          // The mapped text dictionary
+    size_t text_size;
+    size_t *lines;             // Start of each line of text, then text_size
 };
 
 struct game_state {
@@ -29,13 +52,17 @@ struct game_state {
     int letters_guessed[NUM_LETTERS]; // Index i will be 1 if the corresponding
                                       // letter has been guessed; 0 otherwise
     int guesses_left;         // Number of guesses remaining
-    struct dictionary dict;
+    struct dictionary *dict;  // Shared by all the rooms
     
     struct client *head;
     struct client *has_next_turn;
+    int id;                   // Number of the room, for the players
+    int num_players;          // Number of clients in head
+    struct game_state *next;  // The next room
 };
 
 
-void init_game(struct game_state *game, char *dict_name);
-int get_file_length(char *filename);
+void init_dictionary(struct dictionary *dict, char *dict_name);
+void get_dictionary_word(struct dictionary *dict, int index, char *buf);
+void init_game(struct game_state *game, unsigned int *seed);
 char *status_message(char *msg, struct game_state *game);
\ No newline at end of file
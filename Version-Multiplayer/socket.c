@@ -32,8 +32,10 @@ struct sockaddr_in *init_server_addr(int port) {
 
 /*
  * Create and set up a socket for a server to listen on.
+ * If reuse_port is set, other sockets can listen on the same port too,
+ * and the kernel spreads the incoming connections over them.
  */
-int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
+int set_up_server_socket(struct sockaddr_in *self, int num_queue, int reuse_port) {
     int soc = socket(PF_INET, SOCK_STREAM, 0);
     if (soc < 0) {
         perror("socket");
@@ -49,6 +51,11 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
         perror("setsockopt");
         exit(1);
     }
+    if (reuse_port && setsockopt(soc, SOL_SOCKET, SO_REUSEPORT,
+                                 (const char *) &on, sizeof(on)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
 
     // Associate the process with the address and a port
     if (bind(soc, (struct sockaddr *)self, sizeof(*self)) < 0) {
@@ -69,26 +76,13 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
 
 
 /*
- * Wait for and accept a new connection.
- * Terminate with exit code 1 if the accept call failed, otherwise return
- * the client's socket descriptor.
+ * Accept a new connection on listenfd, and store the address of the peer
+ * in peer. Return the client's socket descriptor, or -1 with errno set if
+ * no connection could be accepted; on a non-blocking listenfd, EAGAIN
+ * means that no connection is waiting.
  */
-int accept_connection(int listenfd) {
-    struct sockaddr_in peer;
-    unsigned int peer_len = sizeof(peer);
-    peer.sin_family = PF_INET;
-
-    printf("Waiting for a new connection...\n");
-    int client_socket = accept(listenfd, (struct sockaddr *)&peer, &peer_len);
-    if (client_socket < 0) {
-        perror("accept");
-        exit(1);
-    } else {
-        printf("New connection accepted from %s:%d\n",
-            inet_ntoa(peer.sin_addr),
-            ntohs(peer.sin_port));
-        return client_socket;
-    }
+int accept_connection(int listenfd, struct sockaddr_in *peer) {
+    unsigned int peer_len = sizeof(*peer);
+    peer->sin_family = PF_INET;
+    return accept(listenfd, (struct sockaddr *)peer, &peer_len);
 }
-
-
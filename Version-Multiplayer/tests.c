@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "gameplay.h"
+
+/* Checks of how wordsrv splits what its clients send into lines:
+ *     tests <wordsrv> <dictionary>
+ * The server is started on PORT, driven by a few clients, and stopped
+ * with SIGTERM, which it must exit from cleanly. A check that fails
+ * stops the run with an error.
+ */
+
+#ifndef PORT
+    #define PORT 30001
+#endif
+
+/* Milliseconds to wait for an expected reply, or for the server to start */
+#define REPLY_MS 2000
+
+/* Milliseconds between the pieces of a line sent in parts, so that the
+ * server reads each piece on its own
+ */
+#define PIECE_MS 50
+
+/* A connection to the server, and everything it has received */
+struct test_client {
+    int fd;
+    char received[4096];
+    int len;
+};
+
+pid_t server = -1;
+
+
+/* Report the failed check msg, stop the server, and exit */
+void fail(const char *msg, struct test_client *c) {
+    fprintf(stderr, "FAIL: %s\n", msg);
+    if (c != NULL) {
+        fprintf(stderr, "received:\n%.*s\n", c->len, c->received);
+    }
+    if (server != -1) {
+        kill(server, SIGKILL);
+    }
+    exit(1);
+}
+
+void pause_ms(int ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/* Connect to the server, retrying until it listens or REPLY_MS pass */
+void connect_client(struct test_client *c) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int waited = 0; waited < REPLY_MS; waited += PIECE_MS) {
+        c->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (c->fd == -1) {
+            perror("socket");
+            exit(1);
+        }
+        if (connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            c->len = 0;
+            return;
+        }
+        close(c->fd);
+        pause_ms(PIECE_MS);
+    }
+    fail("cannot connect to the server", NULL);
+}
+
+void send_text(struct test_client *c, const char *text) {
+    if (write(c->fd, text, strlen(text)) != strlen(text)) {
+        perror("write");
+        fail("cannot write to the server", c);
+    }
+}
+
+/* Send text in pieces of at most size bytes, PIECE_MS apart */
+void send_pieces(struct test_client *c, const char *text, int size) {
+    char piece[MAX_BUF];
+    for (int len = strlen(text); len > 0; len -= size, text += size) {
+        int n = len < size ? len : size;
+        memcpy(piece, text, n);
+        piece[n] = '\0';
+        send_text(c, piece);
+        pause_ms(PIECE_MS);
+    }
+}
+
+/* Return how many times text occurs in what c has received */
+int count_received(struct test_client *c, const char *text) {
+    int count = 0;
+    c->received[c->len] = '\0';
+    for (char *at = strstr(c->received, text); at != NULL; at = strstr(at + 1, text)) {
+        count++;
+    }
+    return count;
+}
+
+/* Read from c until it has received text count times in all, and fail
+ * with msg if that takes longer than REPLY_MS
+ */
+void expect(struct test_client *c, const char *text, int count, const char *msg) {
+    int waited = 0;
+    while (count_received(c, text) < count) {
+        struct pollfd pfd = {c->fd, POLLIN, 0};
+        if (waited >= REPLY_MS || poll(&pfd, 1, PIECE_MS) == -1) {
+            fail(msg, c);
+        }
+        waited += PIECE_MS;
+        if (pfd.revents & POLLIN) {
+            int r = read(c->fd, c->received + c->len, sizeof(c->received) - 1 - c->len);
+            if (r <= 0) {
+                fail(msg, c);
+            }
+            c->len += r;
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <wordsrv> <dictionary>\n", argv[0]);
+        exit(1);
+    }
+    server = fork();
+    if (server == -1) {
+        perror("fork");
+        exit(1);
+    } else if (server == 0) {
+        execl(argv[1], argv[1], argv[2], (char *) NULL);
+        perror("execl");
+        exit(1);
+    }
+
+    struct test_client alice, bob, carol;
+
+    // A name and a guess in one read: both lines are handled
+    connect_client(&alice);
+    expect(&alice, WELCOME_MSG, 1, "no welcome");
+    send_text(&alice, "alice\r\nzz\r\n");
+    expect(&alice, "alice has just joined room", 1, "two lines in one read: no join");
+    expect(&alice, "Your guess is not valid", 1, "two lines in one read: no reply to the second");
+
+    // A name sent in pieces, with the network newline split too
+    connect_client(&bob);
+    expect(&bob, WELCOME_MSG, 1, "no welcome");
+    send_pieces(&bob, "bob\r\n", 2);
+    expect(&bob, "bob has just joined room", 1, "line in pieces: no join");
+    expect(&alice, "bob has just joined room", 1, "line in pieces: join not broadcast");
+    // It is alice's turn, and bob's line is a whole one
+    send_text(&bob, "e\r\n");
+    expect(&bob, "It is not yet your turn!", 1, "line in pieces: next line not handled");
+
+    // An empty name and a taken one in one read, then a free one: the
+    // taken name is turned down once, however many lines follow
+    connect_client(&carol);
+    expect(&carol, WELCOME_MSG, 1, "no welcome");
+    send_text(&carol, "\r\nalice\r\n");
+    expect(&carol, "was empty", 1, "empty name not turned down");
+    expect(&carol, "was taken", 1, "taken name not turned down");
+    send_text(&carol, "carol\r\n");
+    expect(&carol, "carol has just joined room", 1, "free name after a taken one: no join");
+    if (count_received(&carol, "was taken") != 1) {
+        fail("taken name turned down more than once", &carol);
+    }
+    expect(&alice, "carol has just joined room", 1, "join after a taken name not broadcast");
+    if (count_received(&alice, "alice has just joined") != 1) {
+        fail("taken name joined a room", &alice);
+    }
+
+    // The server lets its players go on SIGTERM, and exits cleanly
+    int status;
+    kill(server, SIGTERM);
+    if (waitpid(server, &status, 0) == -1) {
+        perror("waitpid");
+        exit(1);
+    }
+    server = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fail("the server did not exit cleanly on SIGTERM", NULL);
+    }
+    close(alice.fd);
+    close(bob.fd);
+    close(carol.fd);
+    printf("wordsrv line handling: all checks passed\n");
+    return 0;
+}
@@ -6,11 +6,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "socket.h"
 #include "gameplay.h"
@@ -19,11 +24,15 @@
 #ifndef PORT
     #define PORT 30001
 #endif
-#define MAX_QUEUE 5
+#define MAX_QUEUE SOMAXCONN
+#define MAX_EVENTS 256 /* Most events handled per epoll_wait */
+#define USAGE "Usage: %s [-t threads] [-v] <dictionary filename>\n"
 
 
-void add_player(struct client **top, int fd, struct in_addr addr);
+struct client *add_player(struct client **top, int fd, struct in_addr addr);
 void remove_player(struct client **top, int fd);
+/* Queue msg to be written to p */
+void send_to(struct client *p, const char *msg);
 /* Send the message in outbuf to all clients */
 void broadcast(struct game_state *game, char *outbuf);
 void announce_turn(struct game_state *game);
@@ -31,6 +40,7 @@ void announce_winner(struct game_state *game, struct client *winner);
 /* Move the has_next_turn pointer to the next active client */
 void advance_turn(struct game_state *game);
 void disconnect_handler(struct game_state *game, int fd, char *name);
+void *Malloc(size_t size);
 
 /* Broadcase the message outbuf to all the players inside the game
 pointed to by the struct game_state pointer game. 
@@ -38,15 +48,8 @@ Precondition: outbuf is terminated by a network newline */
 void broadcast(struct game_state *game, char *outbuf) {
     struct client *p;
     for (p = game->head; p != NULL; p = p->next) {
-        int r = write(p->fd, outbuf, sizeof(char) * strlen(outbuf));
-        // this player has left the game, so remove him/her
-        // and broadcase this info to all other players
-        if (r == -1) {
-            char *name = malloc(strlen(p->name) + 1);
-            strcpy(name, p->name);
-            disconnect_handler(game, p->fd, name);
-            free(name);
-        }
+        // a player that cannot keep up is dropped by send_to
+        send_to(p, outbuf);
     }
 }
 
@@ -62,20 +65,13 @@ void announce_turn(struct game_state *game) {
     } else {
         sprintf(msg_other_player, "It's %s's turn\r\n", (game->has_next_turn)->name);
     }
-    int nxt_player_fd = (game->has_next_turn)->fd;
+    int nxt_player_fd = game->has_next_turn != NULL ? game->has_next_turn->fd : -1;
     struct client *p;
-    int r;
     for (p = game->head; p != NULL; p = p->next) {
         if (p->fd == nxt_player_fd) {
-            r = write(p->fd, msg_nxt_player, sizeof(char) * strlen(msg_nxt_player));
+            send_to(p, msg_nxt_player);
         } else {
-            r = write(p->fd, msg_other_player, sizeof(char) * strlen(msg_other_player));
-        }
-        if (r == -1) {
-            char *name = malloc(strlen(p->name) + 1);
-            strcpy(name, p->name);
-            disconnect_handler(game, p->fd, name);
-            free(name);
+            send_to(p, msg_other_player);
         }
     }
 }
@@ -87,36 +83,37 @@ void announce_winner(struct game_state *game, struct client *winner) {
     sprintf(msg_other, "Game over! %s won!\r\n", winner->name);
     char *msg_winner = "Game over! Congrats! You win!\r\n";
     for (p = game->head; p != NULL; p = p->next) {
-        int r;
         if (p->fd == winner->fd) {
-            r = write(p->fd, msg_winner, sizeof(char) * strlen(msg_winner));
+            send_to(p, msg_winner);
         } else {
-            r = write(p->fd, msg_other, sizeof(char) * strlen(msg_other));
-        }
-        if (r == -1) {
-            char *name = malloc(strlen(p->name) + 1);
-            strcpy(name, p->name);
-            disconnect_handler(game, p->fd, name);
-            free(name);
+            send_to(p, msg_other);
         }
     }
 }
 
 /*
  * Handle a disconnected player with file descriptor fd, if some 
- * read/write call failed. Also broadcast a goodbye information 
- * to all the players
+ * read/write call failed or it was dropped. Also broadcast a goodbye
+ * information to all the players
  */
 void disconnect_handler(struct game_state *game, int fd, char *name) {
     char msg[MAX_MSG];
-    printf("%s has left\n", name);
-    sprintf(msg, "Goodbye %s\r\n", name);
-    broadcast(game, msg);
+    if (fd == -1) { // already removed
+        return;
+    }
+    LOG("%s has left\n", name);
     if (game->has_next_turn != NULL && game->has_next_turn->fd == fd) {
         advance_turn(game);
         // game->has_next_turn = game->has_next_turn->next;
     }
     remove_player(&(game->head), fd);
+    game->num_players--;
+    // the last player has left, so the next one to join gets the turn
+    if (game->head == NULL) {
+        game->has_next_turn = NULL;
+    }
+    sprintf(msg, "Goodbye %s\r\n", name);
+    broadcast(game, msg);
     // if (game->has_next_turn != NULL) {
     //     announce_turn(game);
     // }
@@ -140,16 +137,201 @@ void advance_turn(struct game_state *game) {
     }
 }
 
-/* The set of socket descriptors for select to monitor.
- * This is a global variable because we need to remove socket descriptors
- * from allset when a write to a socket fails.
+/* 1 if the server was started with -v. Set once, before the shards
+ * start, so it is only ever read while they run.
+ */
+int verbose = 0;
+
+
+/* The state below belongs to the shard (see struct shard) running on
+ * the thread, so every thread has its own copy and no locks are needed.
+ */
+
+/* The epoll instance that watches the listening socket and every client.
+ * This is a global variable because we need to stop watching a socket
+ * descriptor when a write to the socket fails.
+ */
+__thread int epfd;
+
+/* Clients removed while the current batch of events is handled. They are
+ * freed only once the whole batch has been handled, because a later event
+ * of the batch (or a loop over a player list) may still point to them.
+ */
+__thread struct client *removed = NULL;
+
+/* Clients to disconnect once the current batch of events is handled,
+ * because their socket failed or they let too much output pile up.
+ */
+__thread struct client *dropped = NULL;
+
+
+/* The game rooms, each with at most ROOM_SIZE players. A room is opened
+ * when a named player finds every room full, and closed after the batch
+ * of events in which its last player left.
+ */
+__thread struct game_state *rooms = NULL;
+__thread int next_room_id;
+__thread int room_id_step; // Number of shards, which number their rooms in turn
+
+/* The seed the shard draws the words of its rooms from, with rand_r */
+__thread unsigned int word_seed;
+
+
+/* A descriptor kept open so that one can be freed when the server runs
+ * out of them, to accept and close a connection that would otherwise
+ * stay waiting, and keep the listening socket readable forever.
+ */
+__thread int spare_fd = -1;
+
+
+/* An eventfd that SIGINT and SIGTERM make readable. Every shard watches
+ * it, and stops once it is readable; it is never read, so it stays so.
+ */
+int stop_fd = -1;
+
+void request_stop(int sig) {
+    uint64_t one = 1;
+    write(stop_fd, &one, sizeof(one));
+}
+
+
+/* Watch fd for input, with p as the data of its events (NULL for the
+ * listening socket).
+ */
+void watch_fd(int fd, struct client *p) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = p;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+
+/* Watch the socket of p for input, and also for room to write if
+ * p has output queued.
+ */
+void watch_output(struct client *p) {
+    struct epoll_event ev;
+    ev.events = p->out_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = p;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, p->fd, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+
+/* Disconnect p once the current batch of events is handled. Until then
+ * nothing more is written to p, and its input is ignored.
  */
-fd_set allset;
+void drop_client(struct client *p) {
+    if (!p->dropped) {
+        p->dropped = 1;
+        p->next_dropped = dropped;
+        dropped = p;
+    }
+}
 
 
-/* Add a client to the head of the linked list
+/* Queue msg for p, and write as much of it right away as the socket
+ * takes without blocking; flush_output writes the rest once the socket
+ * can take more. A client whose queue would grow past MAX_BACKLOG bytes,
+ * or whose socket fails, is dropped, so one slow reader cannot hold up
+ * the others.
  */
-void add_player(struct client **top, int fd, struct in_addr addr) {
+void send_to(struct client *p, const char *msg) {
+    if (p->fd == -1 || p->dropped) {
+        return;
+    }
+    size_t len = strlen(msg);
+    int was_empty = p->out_len == 0;
+    if (was_empty) {
+        ssize_t r = write(p->fd, msg, len);
+        if (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            drop_client(p);
+            return;
+        }
+        if (r > 0) {
+            msg += r;
+            len -= r;
+        }
+        if (len == 0) {
+            return;
+        }
+    }
+    if (p->out_len + len > MAX_BACKLOG) {
+        LOG("[%d] is too slow, dropping it\n", p->fd);
+        drop_client(p);
+        return;
+    }
+    // Make room at the end of the queue: move what is left to the front,
+    // and grow the queue if that is not enough
+    if (p->out_start + p->out_len + len > p->out_size) {
+        memmove(p->out, p->out + p->out_start, p->out_len);
+        p->out_start = 0;
+        if (p->out_len + len > p->out_size) {
+            p->out_size = p->out_size * 2 > p->out_len + len ? p->out_size * 2 : p->out_len + len;
+            p->out = realloc(p->out, p->out_size);
+            if (p->out == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+    }
+    memcpy(p->out + p->out_start + p->out_len, msg, len);
+    p->out_len += len;
+    if (was_empty) {
+        watch_output(p);
+    }
+}
+
+
+/* Write as much of the output queued for p as its socket takes. */
+void flush_output(struct client *p) {
+    ssize_t r = write(p->fd, p->out + p->out_start, p->out_len);
+    if (r == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            drop_client(p);
+        }
+        return;
+    }
+    p->out_start += r;
+    p->out_len -= r;
+    if (p->out_len == 0) {
+        p->out_start = 0;
+        watch_output(p);
+    }
+}
+
+
+/* Disconnect the clients dropped while the last batch of events was
+ * handled, and those dropped in turn by saying goodbye to them.
+ * new_players is the list of clients without a room.
+ */
+void disconnect_dropped(struct client **new_players) {
+    while (dropped != NULL) {
+        struct client *p = dropped;
+        dropped = p->next_dropped;
+        if (p->fd == -1) { // already removed
+            continue;
+        }
+        if (p->room != NULL) {
+            char name[MAX_NAME];
+            strcpy(name, p->name);
+            disconnect_handler(p->room, p->fd, name);
+        } else {
+            remove_player(new_players, p->fd);
+        }
+    }
+}
+
+
+/* Add a client to the head of the linked list, and watch its socket,
+ * which is made non-blocking. Return the new client.
+ */
+struct client *add_player(struct client **top, int fd, struct in_addr addr) {
     struct client *p = malloc(sizeof(struct client));
 
     if (!p) {
@@ -157,19 +339,30 @@ void add_player(struct client **top, int fd, struct in_addr addr) {
         exit(1);
     }
 
-    // TODO: printf("Adding client %s\n", inet_ntoa(addr));
-
     p->fd = fd;
     p->ipaddr = addr;
     p->name[0] = '\0';
+    p->room = NULL;
     p->in_ptr = p->inbuf;
     memset(p->inbuf, '\0', MAX_BUF);
+    p->out = NULL;
+    p->out_start = 0;
+    p->out_len = 0;
+    p->out_size = 0;
+    p->dropped = 0;
     p->next = *top;
     *top = p;
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        exit(1);
+    }
+    watch_fd(fd, p);
+    return p;
 }
 
-/* Removes client from the linked list and closes its socket.
- * Also removes socket descriptor from allset 
+/* Removes client from the linked list and closes its socket, which also
+ * takes it out of epfd. The client is freed after the current batch of
+ * events; until then its fd is -1, so it can be recognized and skipped.
  */
 void remove_player(struct client **top, int fd) {
     struct client **p;
@@ -179,10 +372,11 @@ void remove_player(struct client **top, int fd) {
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
-        // TODO: printf("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
-        FD_CLR((*p)->fd, &allset);
+        LOG("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
         close((*p)->fd);
-        free(*p);
+        (*p)->fd = -1;
+        (*p)->next_removed = removed;
+        removed = *p;
         *p = t;
     } else {
         fprintf(stderr, "Trying to remove fd %d, but I don't know about it\n",
@@ -190,6 +384,100 @@ void remove_player(struct client **top, int fd) {
     }
 }
 
+/* Accept every connection waiting on listenfd, which is non-blocking,
+ * into new_players. Running out of descriptors or a connection aborted
+ * before it was accepted is reported, and the server keeps serving.
+ */
+void accept_clients(int listenfd, struct client **new_players) {
+    struct sockaddr_in q;
+    while (1) {
+        int clientfd = accept_connection(listenfd, &q);
+        if (clientfd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                perror("accept");
+                // Turn the connection away, rather than leave it waiting
+                if (spare_fd != -1) {
+                    close(spare_fd);
+                    clientfd = accept(listenfd, NULL, NULL);
+                    if (clientfd != -1) {
+                        close(clientfd);
+                    }
+                    spare_fd = open("/dev/null", O_RDONLY);
+                }
+                return;
+            }
+            perror("accept");
+            return;
+        }
+        LOG("New connection accepted from %s:%d\n",
+            inet_ntoa(q.sin_addr), ntohs(q.sin_port));
+        // we have a new connection, so add the player into the waiting area
+        // Until the player enters an legitimate name, we cannot let the player
+        // participate in the game
+        struct client *p = add_player(new_players, clientfd, q.sin_addr);
+        // If the player disconnects before entering name, send_to
+        // drops the player
+        send_to(p, WELCOME_MSG);
+    }
+}
+
+/* Return a room with a free seat, or NULL if every room is full */
+struct game_state *find_room(void) {
+    for (struct game_state *game = rooms; game != NULL; game = game->next) {
+        if (game->num_players < ROOM_SIZE) {
+            return game;
+        }
+    }
+    return NULL;
+}
+
+/* Open and return a new, empty room that picks its word from dict */
+struct game_state *open_room(struct dictionary *dict) {
+    struct game_state *game = Malloc(sizeof(struct game_state));
+    game->dict = dict;
+    init_game(game, &word_seed);
+    game->head = NULL;
+    game->has_next_turn = NULL;
+    game->id = next_room_id;
+    next_room_id += room_id_step;
+    game->num_players = 0;
+    game->next = rooms;
+    rooms = game;
+    LOG("Room %d opened\n", game->id);
+    return game;
+}
+
+/* Close the rooms that every player has left */
+void close_empty_rooms(void) {
+    struct game_state **game = &rooms;
+    while (*game != NULL) {
+        if ((*game)->head == NULL) {
+            struct game_state *empty = *game;
+            LOG("Room %d closed\n", empty->id);
+            *game = empty->next;
+            free(empty);
+        } else {
+            game = &(*game)->next;
+        }
+    }
+}
+
+/* Free the clients removed while the last batch of events was handled */
+void free_removed_players(void) {
+    while (removed != NULL) {
+        struct client *next = removed->next_removed;
+        free(removed->out);
+        free(removed);
+        removed = next;
+    }
+}
+
 /* Remove the node with fd field fd in the linked list pointed to by
  * the head, which is a pointer to the struct client. We want to change
  * the original struct, and this is why we are passing the pointer in.
@@ -197,7 +485,7 @@ void remove_player(struct client **top, int fd) {
  * case that we are trying to delete the first element of the list
  */
 void remove_from_newplayers(struct client **head, int fd) {
-    printf("[%d] removed from the new player list\n", fd);
+    LOG("[%d] removed from the new player list\n", fd);
     struct client *temp = *head, *prev;
     if (temp != NULL && temp->fd == fd) {
         *head = temp->next;
@@ -244,76 +532,304 @@ void *Malloc(size_t size) {
     return pt;
 }
 
-/* Read from client cur_client, into the inbuf of the client
- * This function resets the in_ptr field after reading, and uses the inbuf
- * field of the cur_client as the buffer
+/* Read what client cur_client has sent into the end of its inbuf, after
+ * the bytes it has sent before (from inbuf up to in_ptr).
  * RETURN VALUES:
- *  >= 0 -----  the length read
- *  -1 -------  the \r\n is not yet found
- *  -2 -------  the client has disconnected
+ *  > 0 ------  the number of bytes read
+ *  -1 -------  there is nothing to read yet
+ *  -2 -------  the client has disconnected, or its connection failed, or
+ *              it filled inbuf without ending a line
  */
-int read_from_client(struct client *cur_client, int max_len) {
+int read_from_client(struct client *cur_client) {
     int r;
-    int length;
-    r = read(cur_client->fd, cur_client->in_ptr, max_len);
+    // Never read past inbuf; a line that does not fit is not a valid one
+    int room = MAX_BUF - 1 - (cur_client->in_ptr - cur_client->inbuf);
+    if (room == 0) {
+        return -2;
+    }
+    r = read(cur_client->fd, cur_client->in_ptr, room);
     if (r == -1) {
-        perror("read");
-        exit(1);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        if (errno != ECONNRESET) { // a reset is just a player leaving
+            perror("read");
+        }
+        return -2;
     } else if (r == 0) {
         return -2;
     }
-    printf("[%d] Read %d bytes\n", cur_client->fd, r);
+    LOG("[%d] Read %d bytes\n", cur_client->fd, r);
     cur_client->in_ptr = &(cur_client->in_ptr[r]);
-    // The line has finished!
-    if ((length = find_network_newline(cur_client->inbuf, MAX_BUF)) > -1) {
-        cur_client->inbuf[length - 2] = '\0';
-        cur_client->in_ptr = &(cur_client->inbuf[0]);
-        // Since we have null terminated the string, we can use the print
-        printf("[%d] Found new line %s\n", cur_client->fd, cur_client->inbuf);
-        return length - 2;
+    return r;
+}
+
+/* If the bytes read from cur_client start with a complete line, null
+ * terminate it in place of its network newline and return its length;
+ * otherwise return -1. Only the bytes read so far are searched.
+ */
+int next_line(struct client *cur_client) {
+    int length = find_network_newline(cur_client->inbuf,
+                                      cur_client->in_ptr - cur_client->inbuf);
+    if (length == -1) {
+        return -1;
     }
-    return -1;
+    cur_client->inbuf[length - 2] = '\0';
+    // Since we have null terminated the string, we can use the print
+    LOG("[%d] Found new line %s\n", cur_client->fd, cur_client->inbuf);
+    return length - 2;
 }
 
-int main(int argc, char **argv) {
-    /* Handler for SIGPIPE, which causes the code to stop
-     * we will use this to determine whether a user has dc'ed or not
-     */
-    struct sigaction sa;
-    sa.sa_handler = SIG_IGN;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
-        perror("sigaction");
-        exit(1);
+/* Drop the line of length length (see next_line) from the front of the
+ * inbuf of cur_client, and move the bytes read after it to the front.
+ */
+void consume_line(struct client *cur_client, int length) {
+    char *rest = &(cur_client->inbuf[length + 2]);
+    int rest_len = cur_client->in_ptr - rest;
+    memmove(cur_client->inbuf, rest, rest_len);
+    cur_client->in_ptr = &(cur_client->inbuf[rest_len]);
+}
+
+/* Handle the line in the inbuf of p, an active player of a room: a guess
+ * if it is p's turn.
+ */
+void handle_guess(struct client *p) {
+    struct game_state *game = p->room;
+    int cur_fd = p->fd;
+    int position = (int) p->inbuf[0] - 97;
+    // CASE ONE: player mistypes during other players' turn
+    if (game->has_next_turn->fd != cur_fd) {
+        char *msg = "It is not yet your turn!\r\n";
+        LOG("[%d] player input not during their turn\n", cur_fd);
+        send_to(p, msg);
+    } else {
+        // CASE TWO: palyer's turn
+        //  - SUBCASE ONE: The player's guess was empty/multiple char
+        if (strlen(p->inbuf) != 1 || position < 0 || position > 26) {
+            char *msg = "Your guess is not valid, please try again:\r\n";
+            send_to(p, msg);
+            LOG("[%d] player input empty/too long\n", cur_fd);
+            //  - SUBCASE TWO: valid, proceed the game
+        } else {
+            // if the letter was already guessed
+            if (game->letters_guessed[position] == 1) {
+                char *msg = "That was already guessed, try again:\r\n";
+                send_to(p, msg);
+                LOG("[%d] player guessed existing letter\n", cur_fd);
+                // if the letter was not in the word
+            } else if (strstr(game->word, p->inbuf) == NULL) {
+                char *msg = "Your guess was not in the word\r\n";
+                send_to(p, msg);
+                LOG("[%d] player guessed wrong\n", cur_fd);
+                game->letters_guessed[position] = 1;
+                advance_turn(game);
+                game->guesses_left -= 1;
+                int game_fin = 0;
+                if (game->guesses_left == 0) {
+                    char msg[MAX_MSG];
+                    sprintf(msg, "%s used up all the guesses, you lost!\r\n", p->name);
+                    broadcast(game, msg);
+                    broadcast(game, "Let's start a new game!\r\n");
+                    init_game(game, &word_seed);
+                    char new_status[MAX_MSG];
+                    status_message(new_status, game);
+                    broadcast(game, new_status);
+                    announce_turn(game);
+                    game_fin = 1;
+                    LOG("The game trials has been exausted\n");
+                }
+                if (game_fin == 0) {
+                    char status[MAX_MSG];
+                    status_message(status, game);
+                    broadcast(game, status);
+                    announce_turn(game);
+                }
+                // the letter is in the word
+            } else {
+                game->letters_guessed[position] = 1;
+                for (int i = 0; i < strlen(game->guess); i++) {
+                    if (game->guess[i] == '-' && game->word[i] == p->inbuf[0]) {
+                        game->guess[i] = p->inbuf[0];
+                    }
+                }
+                // the game has end
+                if (strcmp(game->guess, game->word) == 0) {
+                    announce_winner(game, p);
+                    LOG("%s has won, starting a new game\n", p->name);
+                    broadcast(game, "Let's start a new game!\r\n");
+                    init_game(game, &word_seed);
+                    char new_status[MAX_MSG];
+                    status_message(new_status, game);
+                    broadcast(game, new_status);
+                    announce_turn(game);
+                    // the game proceeds, the player guesses again
+                } else {
+                    broadcast(game, "Good guess!\r\n");
+                    char msg[MAX_MSG];
+                    status_message(msg, game);
+                    broadcast(game, msg);
+                    announce_turn(game);
+                    LOG("[%d] guessed correctly, guessing again\n", cur_fd);
+                }
+            }
+        }
     }
+}
 
-    int clientfd, maxfd, nready;
-    struct client *p;
-    struct sockaddr_in q;
-    fd_set rset;
+/* Return 1 if a player in game is called name, or 0 if not. Names are
+ * cut to MAX_NAME - 1 characters when they are taken, so only that much
+ * of name is compared.
+ */
+int name_taken(struct game_state *game, char *name) {
+    for (struct client *q = game->head; q != NULL; q = q->next) {
+        if (q->fd != -1 && strncmp(q->name, name, MAX_NAME - 1) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Handle the line of length name_len in the inbuf of p, a client in
+ * new_players that has not entered its name yet. Once p enters a name
+ * that is not empty, and not taken in the room with a free seat, p moves
+ * from new_players into that room. If every room is full, p gets a new
+ * room, which picks its word from dict.
+ */
+void handle_name(struct client **new_players, struct client *p,
+                 struct dictionary *dict, int name_len) {
+    int cur_fd = p->fd;
+    if (name_len == 0) {
+        char *msg = "The user name that you entered was empty, please try again: \r\n";
+        LOG("[%d] entered an empty name\n", cur_fd);
+        send_to(p, msg);
+    } else if (name_len > 0) {
+        struct game_state *game = find_room();
+        if (game != NULL && name_taken(game, p->inbuf)) {
+            char *msg = "The user name that you entered was taken, please try again: \r\n";
+            LOG("[%d] entered an existing name\n", cur_fd);
+            send_to(p, msg);
+            return;
+        }
+        // so the name is valid if it reaches here
+        if (game == NULL) {
+            game = open_room(dict);
+        }
+        // set fields as appropriate
+        strncpy(p->name, p->inbuf, MAX_NAME);
+        // p->name should be null terminated, but we should be carefull with the size
+        p->name[MAX_NAME - 1] = '\0';
+        LOG("[%d] %s has joined room %d\n", p->fd, p->name, game->id);
+        // update the new_players
+        remove_from_newplayers(new_players, cur_fd);
+        p->next = game->head;
+        game->head = p;
+        game->num_players++;
+        p->room = game;
+        // so if this is a fresh new game
+        if (game->has_next_turn == NULL) {
+            game->has_next_turn = p;
+        }
+        // The new player has joined, report the status of the game to the new player
+        char *msg = Malloc(MAX_MSG);
+        sprintf(msg, "%s has just joined room %d, hello there!\r\n", p->name, game->id);
+        broadcast(game, msg);
+        memset(msg, '\0', MAX_MSG);
+        msg = status_message(msg, game);
+        send_to(p, msg);
+        free(msg);
+        announce_turn(game);
+    }
+}
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <dictionary filename>\n", argv[0]);
+/* Handle the input of p that has arrived: every complete line it has sent
+ * is a name while p is in new_players, and a guess once p is in a room.
+ */
+void handle_input(struct client **new_players, struct client *p, struct dictionary *dict) {
+    int length;
+    int status = read_from_client(p);
+    if (status == -2) {
+        if (p->room != NULL) {
+            char name[MAX_NAME];
+            strcpy(name, p->name);
+            disconnect_handler(p->room, p->fd, name);
+        } else {
+            remove_player(new_players, p->fd);
+        }
+        return;
+    }
+    // p may be removed or dropped by the line before
+    while (p->fd != -1 && !p->dropped && (length = next_line(p)) != -1) {
+        if (p->room == NULL) {
+            handle_name(new_players, p, dict, length);
+        } else {
+            handle_guess(p);
+        }
+        consume_line(p, length);
+    }
+}
+
+/* Raise the limit on open file descriptors as far as it goes, since the
+ * server holds one per connection.
+ */
+void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("getrlimit");
         exit(1);
     }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("setrlimit");
+    }
+}
 
-    // Create and initialize the game state
-    struct game_state game;
+/* One worker of the server: a thread with its own listening socket, event
+ * loop, players and rooms. The kernel spreads new connections over the
+ * listening sockets (SO_REUSEPORT), so the shards share nothing they write.
+ */
+struct shard {
+    int id;                  // 0 to num_shards - 1
+    int num_shards;
+    int listenfd;
+    struct dictionary *dict; // Shared by all the shards, and only read
+    unsigned int seed;       // Where word_seed starts
+    pthread_t thread;
+};
+
+/* Disconnect every client of the shard, close its rooms, and release the
+ * descriptors it holds. new_players is the list of clients without a room.
+ */
+void close_shard(struct shard *shard, struct client **new_players) {
+    while (*new_players != NULL) {
+        remove_player(new_players, (*new_players)->fd);
+    }
+    for (struct game_state *game = rooms; game != NULL; game = game->next) {
+        while (game->head != NULL) {
+            remove_player(&game->head, game->head->fd);
+        }
+    }
+    free_removed_players();
+    close_empty_rooms();
+    close(shard->listenfd);
+    close(epfd);
+    if (spare_fd != -1) {
+        close(spare_fd);
+        spare_fd = -1;
+    }
+}
 
-    srandom((unsigned int) time(NULL));
-    // Set up the file pointer outside of init_game because we want to 
-    // just rewind the file when we need to pick a new word
-    game.dict.fp = NULL;
-    // This is the number of words that is in our dictionary
-    game.dict.size = get_file_length(argv[1]);
-    // We pass the game state struct and the dictionary file to init the game
-    init_game(&game, argv[1]);
+/* Run the event loop of the shard arg until the server is stopped. */
+void *serve(void *arg) {
+    struct shard *shard = arg;
+    int stopping = 0;
+    int nready;
+    struct client *p;
+    struct epoll_event events[MAX_EVENTS];
 
-    // head and has_next_turn also don't change when a subsequent game is
-    // started so we initialize them here.
-    game.head = NULL;
-    game.has_next_turn = NULL;
+    // Room numbers are unique across the shards
+    next_room_id = shard->id + 1;
+    room_id_step = shard->num_shards;
+    word_seed = shard->seed;
 
     /* A list of client who have not yet entered their name.  This list is
      * kept separate from the list of active players in the game, because
@@ -323,254 +839,147 @@ int main(int argc, char **argv) {
      */
     struct client *new_players = NULL;
 
-    struct sockaddr_in *server = init_server_addr(PORT);
-    int listenfd = set_up_server_socket(server, MAX_QUEUE);
-
-    // initialize allset and add listenfd to the
-    // set of file descriptors passed into select
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    // maxfd identifies how far into the set to search
-    maxfd = listenfd;
+    // The events of every client carry its struct client, so each ready
+    // descriptor is dispatched without searching the player lists; the
+    // listening socket carries NULL
+    epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    // Every waiting connection is accepted at once, so the listening
+    // socket must not block once they are all taken
+    if (fcntl(shard->listenfd, F_SETFL, fcntl(shard->listenfd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        exit(1);
+    }
+    spare_fd = open("/dev/null", O_RDONLY);
+    watch_fd(shard->listenfd, NULL);
+    struct epoll_event stop_ev;
+    stop_ev.events = EPOLLIN;
+    stop_ev.data.ptr = &stop_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, stop_fd, &stop_ev) == -1) {
+        perror("epoll_ctl");
+        exit(1);
+    }
 
-    while (1) {
-        // make a copy of the set before we pass it into select
-        rset = allset;
-        nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
+    while (!stopping) {
+        nready = epoll_wait(epfd, events, MAX_EVENTS, -1);
         if (nready == -1) {
-            perror("select");
+            if (errno != EINTR) {
+                perror("epoll_wait");
+            }
             continue;
         }
 
-        /* FD_ISSET() tests to see if a file descriptor is
-        part of the set; this is useful after select() returns. */
-        if (FD_ISSET(listenfd, &rset)) {
-            printf("A new client is connecting\n");
-            clientfd = accept_connection(listenfd);
-            /* FD_SET() and FD_CLR() respectively add and remove  a  given  file
-            descriptor from a set. */
-            FD_SET(clientfd, &allset);
-            if (clientfd > maxfd) {
-                maxfd = clientfd;
+        for (int i = 0; i < nready; i++) {
+            if (events[i].data.ptr == &stop_fd) {
+                stopping = 1;
+                continue;
+            }
+            p = events[i].data.ptr;
+            if (p == NULL) {
+                accept_clients(shard->listenfd, &new_players);
+                continue;
+            }
+            if (p->fd == -1 || p->dropped) {
+                // removed or dropped while handling an earlier event of this batch
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_output(p);
             }
-            // TODO: printf("Connection from %s\n", inet_ntoa(q.sin_addr));
-            // we have a new connection, so add the player into the waiting area
-            // Until the player enters an legitimate name, we cannot let the player
-            // participate in the game
-            add_player(&new_players, clientfd, q.sin_addr);
-            char *greeting = WELCOME_MSG;
-            /* If we cannot write to the client's file descriptor, we rmove the
-            client from the player list */
-            if (write(clientfd, greeting, strlen(greeting)) == -1) {
-                // This handles the case that the player disconnects before entering name
-                fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                remove_player(&new_players, p->fd); // Fixed as per in the email
-            };
+            if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) || p->dropped) {
+                continue;
+            }
+            handle_input(&new_players, p, shard->dict);
         }
+        disconnect_dropped(&new_players);
+        free_removed_players();
+        close_empty_rooms();
+    }
+    close_shard(shard, &new_players);
+    return NULL;
+}
 
-        /* Check which other socket descriptors have something ready to read.
-         * The reason we iterate over the rset descriptors at the top level and
-         * search through the two lists of clients each time is that it is
-         * possible that a client will be removed in the middle of one of the
-         * operations. This is also why we call break after handling the input.
-         * If a client has been removed the loop variables may not longer be 
-         * valid.
-         */
-        int cur_fd;
-        for (cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
-            if (FD_ISSET(cur_fd, &rset)) {
-                // Check if this socket descriptor is an active player
-
-                for (p = game.head; p != NULL; p = p->next) {
-                    if (cur_fd == p->fd) {
-                        int inlen = read_from_client(p, MAX_BUF);
-                        // we have a disconnection
-                        int has_disconnect = 0;
-                        if (inlen == -2) {
-                            char *name = malloc(strlen(p->name) + 1);
-                            strcpy(name, p->name);
-                            disconnect_handler(&game, cur_fd, name);
-                            free(name);
-                            has_disconnect = 1;
-                        }
-                        // input confirmed and the player is still online
-                        if (inlen != -1 && has_disconnect == 0) {
-                            int position = (int) p->inbuf[0] - 97;
-                            // CASE ONE: player mistypes during other players' turn
-                            if (game.has_next_turn->fd != cur_fd) {
-                                char *msg = "It is not yet your turn!\r\n";
-                                printf("[%d] player input not during their turn\n", cur_fd);
-                                memset(p->inbuf, '\0', MAX_BUF);
-                                if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                    char *name = malloc(strlen(p->name) + 1);
-                                    strcpy(name, p->name);
-                                    disconnect_handler(&game, p->fd, name);
-                                    free(name);
-                                }
-                            } else {
-                                // CASE TWO: palyer's turn
-                                //  - SUBCASE ONE: The player's guess was empty/multiple char
-                                if (strlen(p->inbuf) != 1 || position < 0 || position > 26) {
-                                    char *msg = "Your guess is not valid, please try again:\r\n";
-                                    if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                        char *name = malloc(strlen(p->name) + 1);
-                                        strcpy(name, p->name);
-                                        disconnect_handler(&game, p->fd, name);
-                                        free(name);
-                                    }
-                                    printf("[%d] player input empty/too long\n", cur_fd);
-                                    memset(p->inbuf, '\0', MAX_BUF);
-                                    //  - SUBCASE TWO: valid, proceed the game
-                                } else {
-                                    // if the letter was already guessed
-                                    if (game.letters_guessed[position] == 1) {
-                                        char *msg = "That was already guessed, try again:\r\n";
-                                        if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                            char *name = malloc(strlen(p->name) + 1);
-                                            strcpy(name, p->name);
-                                            disconnect_handler(&game, p->fd, name);
-                                            free(name);
-                                        }
-                                        printf("[%d] player guessed existing letter\n", cur_fd);
-                                        memset(p->inbuf, '\0', MAX_BUF);
-                                        // if the letter was not in the word
-                                    } else if (strstr(game.word, p->inbuf) == NULL) {
-                                        char *msg = "Your guess was not in the word\r\n";
-                                        if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                            char *name = malloc(strlen(p->name) + 1);
-                                            strcpy(name, p->name);
-                                            disconnect_handler(&game, p->fd, name);
-                                            free(name);
-                                        }
-                                        printf("[%d] player guessed wrong\n", cur_fd);
-                                        game.letters_guessed[position] = 1;
-                                        advance_turn(&game);
-                                        game.guesses_left -= 1;
-                                        int game_fin = 0;
-                                        if (game.guesses_left == 0) {
-                                            char msg[MAX_MSG];
-                                            sprintf(msg, "%s used up all the guesses, you lost!\r\n", p->name);
-                                            broadcast(&game, msg);
-                                            broadcast(&game, "Let's start a new game!\r\n");
-                                            init_game(&game, argv[1]);
-                                            char new_status[MAX_MSG];
-                                            status_message(new_status, &game);
-                                            broadcast(&game, new_status);
-                                            announce_turn(&game);
-                                            game_fin = 1;
-                                            printf("The game trials has been exausted\n");
-                                        }
-                                        if (game_fin == 0) {
-                                            char status[MAX_MSG];
-                                            status_message(status, &game);
-                                            broadcast(&game, status);
-                                            announce_turn(&game);
-                                        }
-                                        // the letter is in the word
-                                    } else {
-                                        game.letters_guessed[position] = 1;
-                                        for (int i = 0; i < strlen(game.guess); i++) {
-                                            if (game.guess[i] == '-' && game.word[i] == p->inbuf[0]) {
-                                                game.guess[i] = p->inbuf[0];
-                                            }
-                                        }
-                                        // the game has end
-                                        if (strcmp(game.guess, game.word) == 0) {
-                                            announce_winner(&game, p);
-                                            printf("%s has won, starting a new game\n", p->name);
-                                            broadcast(&game, "Let's start a new game!\r\n");
-                                            init_game(&game, argv[1]);
-                                            char new_status[MAX_MSG];
-                                            status_message(new_status, &game);
-                                            broadcast(&game, new_status);
-                                            announce_turn(&game);
-                                            // the game proceeds, the player guesses again
-                                        } else {
-                                            broadcast(&game, "Good guess!\r\n");
-                                            char msg[MAX_MSG];
-                                            status_message(msg, &game);
-                                            broadcast(&game, msg);
-                                            announce_turn(&game);
-                                            printf("[%d] guessed correctly, guessing again\n", cur_fd);
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        break;
-                    }
-                }
+int main(int argc, char **argv) {
+    /* Handler for SIGPIPE, which causes the code to stop
+     * we will use this to determine whether a user has dc'ed or not
+     */
+    struct sigaction sa;
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
 
-                // Check if any new players are entering their names
-                for (p = new_players; p != NULL; p = p->next) {
-                    // cur_fd is the file descriptor that we are interested in
-                    if (cur_fd == p->fd) {
-                        int name_len = read_from_client(p, MAX_NAME);
-                        if (name_len == 0) {
-                            char *msg = "The user name that you entered was empty, please try again: \r\n";
-                            printf("[%d] entered an empty name\n", cur_fd);
-                            if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                // fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                                remove_player(&new_players, p->fd);
-                            }
-                            memset(p->inbuf, '\0', MAX_BUF);
-                            p->in_ptr = &(p->inbuf[0]);
-                        } else if (name_len > 0) {
-                            struct client *cache = game.head;
-                            int duplicate_name = 0;
-                            for (; cache != NULL; cache = cache->next) {
-                                if (strcmp(cache->name, p->inbuf) == 0 && cache->fd != -1) {
-                                    duplicate_name = 1;
-                                    char *msg = "The user name that you entered was taken, please try again: \r\n";
-                                    printf("[%d] entered an existing name\n", cur_fd);
-                                    if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                        // fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                                        remove_player(&new_players, p->fd);
-                                    }
-                                    memset(p->inbuf, '\0', MAX_BUF);
-                                    // the name alraedy exists
-                                }
-                            }
-                            // so the name is valid if it reaches here
-                            if (duplicate_name == 0) {
-                                // set fields as appropriate
-                                strncpy(p->name, p->inbuf, MAX_NAME);
-                                // p->name should be null terminated, but we should be carefull with the size
-                                p->name[MAX_NAME - 1] = '\0';
-                                printf("[%d] %s has joined the game\n", p->fd, p->name);
-                                // update the new_players
-                                remove_from_newplayers(&new_players, cur_fd);
-                                p->next = game.head;
-                                game.head = p;
-                                // so if this is a fresh new game
-                                if (game.has_next_turn == NULL) {
-                                    game.has_next_turn = p;
-                                }
-                                memset(p->inbuf, '\0', MAX_BUF);
-                                // The new player has joined, report the status of the game to the new player
-                                char *msg = Malloc(MAX_MSG);
-                                sprintf(msg, "%s has just joined the game, hello there!\r\n", p->name);
-                                broadcast(&game, msg);
-                                memset(msg, '\0', MAX_MSG);
-                                msg = status_message(msg, &game);
-                                if (write(cur_fd, msg, strlen(msg)) == -1) {
-                                    char *name = malloc(strlen(p->name) + 1);
-                                    strcpy(name, p->name);
-                                    disconnect_handler(&game, p->fd, name);
-                                    free(name);
-                                }
-                                free(msg);
-                                announce_turn(&game);
-                                break;
-                            }
-                            memset(p->inbuf, '\0', MAX_BUF);
-                        } else if (name_len == -2) {
-                            remove_from_newplayers(&new_players, cur_fd);
-                        }
-                    }
-                }
-            }
+    int num_shards = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:v")) != -1) {
+        switch (opt) {
+        case 't':
+            num_shards = strtol(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(1);
         }
     }
+    if (optind != argc - 1 || num_shards < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+    raise_fd_limit();
+
+    // SIGINT and SIGTERM stop every shard, which then lets its players go
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (stop_fd == -1) {
+        perror("eventfd");
+        exit(1);
+    }
+    sa.sa_handler = request_stop;
+    if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    // The rooms are opened as players arrive, and all pick their words
+    // from one dictionary
+    struct dictionary dict;
+
+    // Set up the dictionary outside of init_game because we want to 
+    // reuse it (it is mapped and indexed) when we need to pick a new word
+    init_dictionary(&dict, argv[optind]);
+
+    // Every shard listens on the same port; the first one runs on this thread,
+    struct sockaddr_in *server = init_server_addr(PORT);
+    // and picks its words from its own seed
+    unsigned int seed = (unsigned int) time(NULL);
+    struct shard *shards = Malloc(sizeof(struct shard) * num_shards);
+    for (int i = 0; i < num_shards; i++) {
+        shards[i].id = i;
+        shards[i].num_shards = num_shards;
+        shards[i].listenfd = set_up_server_socket(server, MAX_QUEUE, num_shards > 1);
+        shards[i].dict = &dict;
+        shards[i].seed = seed + i;
+    }
+    for (int i = 1; i < num_shards; i++) {
+        if (pthread_create(&shards[i].thread, NULL, serve, &shards[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    serve(&shards[0]);
+    for (int i = 1; i < num_shards; i++) {
+        pthread_join(shards[i].thread, NULL);
+    }
+    free(shards);
+    free(server);
+    close(stop_fd);
     return 0;
 }